@@ -88,6 +88,12 @@ void actsig_process(struct actsig_signal *signal) {
     }
 }
 
+clock_time_t actsig_remaining(struct actsig_signal *signal) {
+    if (!signal->is_signaling)
+        return TIMER_NEVER;
+    return timer_remaining(&signal->signal_timer);
+}
+
 void _actsig_toggle(struct actsig_signal *signal) {
     if (signal->normal_state) {
         /* Signal is normaly on. */
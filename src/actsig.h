@@ -67,4 +67,10 @@ void actsig_set_normal_off(struct actsig_signal *signal);
  */
 void actsig_process(struct actsig_signal *signal);
 
+/**
+ * @param signal Signal object.
+ * @return Clock ticks until signal ends, TIMER_NEVER if not signaling.
+ */
+clock_time_t actsig_remaining(struct actsig_signal *signal);
+
 #endif
@@ -0,0 +1,65 @@
+/*
+ * Copyright (C) Ivo Slanina <ivo.slanina@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdbool.h>
+#include <avr/pgmspace.h>
+#include "../common.h"
+#include "fixfmt.h"
+
+/** Digit weights, digits are found by subtraction instead of division. */
+static const uint16_t _fixfmt_pow10[] PROGMEM = {10000, 1000, 100, 10};
+
+uint8_t fixfmt_uint(char *buffer, uint16_t value) {
+    char *p = buffer;
+    bool leading = true;
+    uint16_t weight;
+    uint8_t i;
+    char digit;
+
+    iterate(_fixfmt_pow10, i) {
+        weight = pgm_read_word(&_fixfmt_pow10[i]);
+        for (digit = '0'; value >= weight; value -= weight)
+            digit++;
+        if (digit != '0' || !leading) {
+            *p++ = digit;
+            leading = false;
+        }
+    }
+    *p++ = '0' + value;
+    return p - buffer;
+}
+
+uint8_t fixfmt_tenths(char *buffer, int16_t value) {
+    char *p = buffer;
+    uint8_t len;
+
+    if (value < 0) {
+        *p++ = '-';
+        value = -value;
+    }
+    len = fixfmt_uint(p, (uint16_t) value);
+    if (len == 1) {
+        /* Integral part is zero. */
+        p[1] = p[0];
+        p[0] = '0';
+        len++;
+    }
+    /* Insert decimal point before last digit. */
+    p[len] = p[len - 1];
+    p[len - 1] = '.';
+    return p - buffer + len + 1;
+}
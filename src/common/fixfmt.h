@@ -0,0 +1,51 @@
+/*
+ * Copyright (C) Ivo Slanina <ivo.slanina@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __FIXFMT_H__
+#define __FIXFMT_H__
+
+#include <stdint.h>
+
+/*
+ * Number formatting without printf. Output is not null terminated.
+ */
+
+/** Maximum length of fixfmt_uint() output. */
+#define FIXFMT_UINT_LEN     5
+
+/** Maximum length of fixfmt_tenths() output. */
+#define FIXFMT_TENTHS_LEN   7
+
+/**
+ * Format unsigned decimal number.
+ *
+ * @param buffer Output buffer of at least FIXFMT_UINT_LEN bytes.
+ * @param value Number.
+ * @return Output length.
+ */
+uint8_t fixfmt_uint(char *buffer, uint16_t value);
+
+/**
+ * Format fixed-point number with one decimal digit, e.g. -123 as "-12.3".
+ *
+ * @param buffer Output buffer of at least FIXFMT_TENTHS_LEN bytes.
+ * @param value Number in tenths.
+ * @return Output length.
+ */
+uint8_t fixfmt_tenths(char *buffer, int16_t value);
+
+#endif
@@ -15,19 +15,45 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
-#include <util/delay.h>
+#include <string.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
 #include "common.h"
 #include "config.h"
 #include "dht.h"
 
-#define DHT_TIMEOUT                         400
-#define DHT_INITIAL_BITMASK                 0x80
 #define DHT_NEGATIVE_TEMPERATURE_BITMASK    0x80
 
-#define DHT_SDA_OUTPUT()    (DHT_DDR |= _BV(DHT_SDA))
-#define DHT_SDA_INPUT()     (DHT_DDR &= ~(_BV(DHT_SDA)))
-#define DHT_SDA_HIGH()      (DHT_PORT |= _BV(DHT_SDA))
-#define DHT_SDA_LOW()       (DHT_PORT &= ~(_BV(DHT_SDA)))
+/*
+ * Timer0 runs from F_CPU / 64, which gives 4 us tick at 16 MHz and overflow
+ * every 1.024 ms. Edge timestamps are 8-bit TCNT0 values.
+ */
+#define DHT_TIMER_PRESCALER         64
+#define DHT_TIMER_US(us)            ((uint8_t) ((F_CPU / 1000000UL) * (us) / DHT_TIMER_PRESCALER))
+
+/** Start signal length in Timer0 overflows (~2 ms, sensor needs at least 1 ms). */
+#define DHT_START_OVERFLOWS         2
+/** Whole transfer takes ~5 ms. Give up after ~8 ms. */
+#define DHT_TIMEOUT_OVERFLOWS       8
+/**
+ * Each bit starts with 50 us low followed by 26-28 us high for zero or 70 us
+ * high for one. Bit value is decided by distance of two falling edges.
+ */
+#define DHT_BIT_THRESHOLD           DHT_TIMER_US(100)
+/** Number of falling edges preceding first data bit: response and bit start. */
+#define DHT_PREAMBLE_EDGES          2
+#define DHT_DATA_BIT_LEN            (DHT_DATA_BYTE_LEN * 8)
+
+/* SDA of sensor being measured. */
+#define DHT_SDA_OUTPUT()    (DHT_DDR |= _dht_sda)
+#define DHT_SDA_INPUT()     (DHT_DDR &= ~_dht_sda)
+#define DHT_SDA_HIGH()      (DHT_PORT |= _dht_sda)
+#define DHT_SDA_LOW()       (DHT_PORT &= ~_dht_sda)
+
+/* PCMSK bits of ATmega328P match pin bits of their port. */
+#define DHT_EDGE_INT_ENABLE()   (DHT_PCMSK |= _dht_sda)
+#define DHT_EDGE_INT_DISABLE()  (DHT_PCMSK &= ~_dht_sda)
 
 /** Raw data sent by sensor */
 struct dht_data_raw {
@@ -38,94 +64,195 @@ struct dht_data_raw {
     uint8_t checksum;
 } __attribute__((__packed__));
 
-/* Data from last measurement. */
-struct dht_data dht_data;
+/** State of background measurement. */
+enum dht_state {
+    DHT_STATE_IDLE,         /**< No measurement running. */
+    DHT_STATE_START,        /**< Start signal is being sent. */
+    DHT_STATE_RECEIVE,      /**< Receiving response and data bits. */
+    DHT_STATE_DONE,         /**< Measurement finished, result not decoded yet. */
+};
+
+struct dht_sensor dht_sensors[DHT_SENSORS];
+
+/** SDA pins of sensors. */
+static const uint8_t _dht_pins[DHT_SENSORS] PROGMEM = { DHT_SDA_PINS };
+
+/** Sensor being measured. */
+static uint8_t _dht_channel;
+
+/** SDA pin bit mask of sensor being measured. */
+static uint8_t _dht_sda;
+
+/** Current measurement state. */
+static volatile enum dht_state _dht_state;
+
+/** Result of last measurement. */
+static volatile enum dht_read_status _dht_status = DHT_BUSY;
+
+/** Raw data being received. */
+static union {
+    struct dht_data_raw data;
+    uint8_t bytes[DHT_DATA_BYTE_LEN];
+} _dht_raw;
+
+/** Timer0 overflows since start of current phase. */
+static volatile uint8_t _dht_overflows;
+
+/** Falling edges seen since start signal was released. */
+static volatile uint8_t _dht_edges;
+
+/** Timestamp of previous falling edge. */
+static volatile uint8_t _dht_last_edge;
 
 /* Translation unit private function prototypes */
-uint8_t _dht_read(void *buf);
+
+/**
+ * Finish measurement and return line to idle state.
+ *
+ * @param status Measurement result.
+ */
+static void _dht_finish(enum dht_read_status status);
+
+/**
+ * Decode raw data into data of measured sensor.
+ */
+static enum dht_read_status _dht_decode(void);
 
 void dht_init(void) {
-    DHT_SDA_OUTPUT();
-    DHT_SDA_HIGH();
+    uint8_t channel;
+
+    /* All lines are held high while idle. */
+    times(DHT_SENSORS, channel) {
+        _dht_sda = _BV(pgm_read_byte(&_dht_pins[channel]));
+        dht_sensors[channel].sda = _dht_sda;
+        DHT_SDA_OUTPUT();
+        DHT_SDA_HIGH();
+        /* Pin is masked until needed. */
+        DHT_EDGE_INT_DISABLE();
+    }
+    /* Enable pin change interrupt group of SDA pins. */
+    PCICR |= _BV(DHT_PCIE);
+
+    /* Timer0 in normal mode, F_CPU / 64. */
+    TCCR0A = 0;
+    TCCR0B = _BV(CS01) | _BV(CS00);
+
+    _dht_state = DHT_STATE_IDLE;
 }
 
-enum dht_read_status _dht_read(void *buf) {
-    uint16_t timeout;
-    uint8_t result;
-    uint8_t i;
-    uint8_t j;
+void dht_start(uint8_t channel) {
+    if (_dht_state == DHT_STATE_START || _dht_state == DHT_STATE_RECEIVE)
+        return;
 
-    /* Reset port. */
-    DHT_SDA_OUTPUT();
-    DHT_SDA_HIGH();
-    _delay_ms(100);
+    _dht_channel = channel;
+    _dht_sda = dht_sensors[channel].sda;
+    _dht_status = DHT_BUSY;
+    _dht_edges = 0;
+    memset(_dht_raw.bytes, 0, sizeof(_dht_raw.bytes));
 
-    /* Send request. */
+    /* Send request. Line is released by Timer0 overflow interrupt. */
+    DHT_SDA_OUTPUT();
     DHT_SDA_LOW();
-    _delay_us(1100);
-    DHT_SDA_HIGH();
-    DHT_SDA_INPUT();
-    _delay_us(40);
-
-    if (bit_is_set(DHT_PIN, DHT_SDA))
-        return DHT_ERROR_CONNECT;
-    _delay_us(80);
-
-    if (bit_is_clear(DHT_PIN, DHT_SDA))
-        return DHT_ERROR_ACK;
-    _delay_us(80);
-
-    for (j = 0; j < DHT_DATA_BYTE_LEN; j++) {
-        result = 0;
-        for (i = 0; i < 8; i++) {
-            timeout = 0;
-            while (bit_is_clear(DHT_PIN, DHT_SDA)) {
-                if (timeout++ > 200)
-                    return DHT_ERROR_TIMEOUT;
-            }
+    _dht_state = DHT_STATE_START;
+    _dht_overflows = 0;
+    TCNT0 = 0;
+    TIFR0 = _BV(TOV0);
+    TIMSK0 |= _BV(TOIE0);
+}
+
+enum dht_read_status dht_poll(void) {
+    if (_dht_state == DHT_STATE_DONE) {
+        if (_dht_status == DHT_OK)
+            _dht_status = _dht_decode();
+        _dht_state = DHT_STATE_IDLE;
+    }
+    if (_dht_state != DHT_STATE_IDLE)
+        return DHT_BUSY;
+    return _dht_status;
+}
 
-            _delay_us(30);
-            if (bit_is_set(DHT_PIN, DHT_SDA))
-                result |= _BV(7 - i);
+bool dht_is_busy(void) {
+    return _dht_state == DHT_STATE_START || _dht_state == DHT_STATE_RECEIVE;
+}
 
-            timeout = 0;
-            while (bit_is_set(DHT_PIN, DHT_SDA)) {
-                if(timeout++ > 200)
-                    return DHT_ERROR_TIMEOUT;
+ISR(TIMER0_OVF_vect) {
+    _dht_overflows++;
+    switch (_dht_state) {
+        case DHT_STATE_START:
+            if (_dht_overflows >= DHT_START_OVERFLOWS) {
+                /* Release line, pull-up keeps it high until sensor responds. */
+                DHT_SDA_INPUT();
+                DHT_SDA_HIGH();
+                _dht_overflows = 0;
+                _dht_state = DHT_STATE_RECEIVE;
+                DHT_EDGE_INT_ENABLE();
+            }
+            break;
+        case DHT_STATE_RECEIVE:
+            if (_dht_overflows >= DHT_TIMEOUT_OVERFLOWS) {
+                if (_dht_edges == 0)
+                    _dht_finish(DHT_ERROR_CONNECT);
+                else if (_dht_edges < DHT_PREAMBLE_EDGES)
+                    _dht_finish(DHT_ERROR_ACK);
+                else
+                    _dht_finish(DHT_ERROR_TIMEOUT);
             }
-        }
-        *(((uint8_t *) buf) + j) = result;
+            break;
+        default:
+            TIMSK0 &= ~(_BV(TOIE0));
+            break;
+    }
+}
+
+ISR(DHT_PCINT_vect) {
+    uint8_t now = TCNT0;
+    uint8_t bit;
+
+    /* Only falling edges are timestamped. */
+    if (_dht_state != DHT_STATE_RECEIVE || (DHT_PIN & _dht_sda))
+        return;
+
+    if (_dht_edges >= DHT_PREAMBLE_EDGES) {
+        bit = _dht_edges - DHT_PREAMBLE_EDGES;
+        if ((uint8_t) (now - _dht_last_edge) > DHT_BIT_THRESHOLD)
+            _dht_raw.bytes[bit / 8] |= _BV(7 - (bit % 8));
     }
+    _dht_last_edge = now;
+    _dht_edges++;
+
+    /* Falling edge after last bit terminates transmission. */
+    if (_dht_edges == DHT_PREAMBLE_EDGES + DHT_DATA_BIT_LEN)
+        _dht_finish(DHT_OK);
+}
 
-    /* Reset port. */
+static void _dht_finish(enum dht_read_status status) {
+    DHT_EDGE_INT_DISABLE();
+    TIMSK0 &= ~(_BV(TOIE0));
     DHT_SDA_OUTPUT();
     DHT_SDA_HIGH();
-    _delay_ms(100);
-
-    return DHT_OK;
+    _dht_status = status;
+    _dht_state = DHT_STATE_DONE;
 }
 
-enum dht_read_status dht_read(void) {
-    struct dht_data_raw _raw_data;
-    enum dht_read_status result = _dht_read(&_raw_data);
-    if (result != DHT_OK)
-        return result;
+static enum dht_read_status _dht_decode(void) {
+    struct dht_data_raw *raw = &_dht_raw.data;
+    struct dht_data *data = &dht_sensors[_dht_channel].data;
 
     /* Checksum */
-    uint8_t sum = _raw_data.humidity_msb        +
-                    _raw_data.humidity_lsb      +
-                    _raw_data.temperature_msb   +
-                    _raw_data.temperature_lsb;
-    if (_raw_data.checksum != sum) {
+    uint8_t sum = raw->humidity_msb     +
+                    raw->humidity_lsb   +
+                    raw->temperature_msb +
+                    raw->temperature_lsb;
+    if (raw->checksum != sum) {
         return DHT_ERROR_CHECKSUM;
     }
 
-    dht_data.humidity = (_raw_data.humidity_msb << 8) | _raw_data.humidity_lsb;
-    dht_data.temperature = ((_raw_data.temperature_msb & 0x7f) << 8) | _raw_data.temperature_lsb;
+    data->humidity = (raw->humidity_msb << 8) | raw->humidity_lsb;
+    data->temperature = ((raw->temperature_msb & 0x7f) << 8) | raw->temperature_lsb;
 
-    if ((_raw_data.temperature_msb & 0x80)) {
-        dht_data.temperature = -dht_data.temperature;
+    if ((raw->temperature_msb & DHT_NEGATIVE_TEMPERATURE_BITMASK)) {
+        data->temperature = -data->temperature;
     }
 
-    return result;
+    return DHT_OK;
 }
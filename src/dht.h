@@ -18,6 +18,25 @@
 #ifndef __DHT_H__
 #define __DHT_H__
 
+#include <stdbool.h>
+#include <stdint.h>
+#include "config.h"
+
+/* Single sensor configuration of older config.h: DHT_SDA and DHT_PCINT. */
+#ifndef DHT_SENSORS
+#define DHT_SENSORS             1
+#endif
+#if !defined(DHT_SDA_PINS) && defined(DHT_SDA)
+#define DHT_SDA_PINS            DHT_SDA
+#endif
+#if defined(DHT_SDA) && defined(DHT_PCINT) && DHT_PCINT != DHT_SDA
+#error "DHT_PCINT must match DHT_SDA, pin change mask bits follow pin bits"
+#endif
+
+#if DHT_SENSORS < 1 || DHT_SENSORS > 6
+#error "DHT_SENSORS must be in range 1 to 6"
+#endif
+
 /** Number of bytes to read. */
 #define DHT_DATA_BYTE_LEN       5
 
@@ -32,12 +51,43 @@ enum dht_read_status {
     DHT_ERROR_TIMEOUT,
     DHT_ERROR_CONNECT,
     DHT_ERROR_ACK,
+    DHT_BUSY,               /**< Measurement in progress or not taken yet. */
 };
 
-extern struct dht_data dht_data;
+/**
+ * Sensor channel. All sensors are wired to DHT_PORT and share its pin change
+ * interrupt, one of them is measured at a time. Packed, host stand-in shares
+ * the array with firmware built with packed structs.
+ */
+struct dht_sensor {
+    uint8_t sda;                    /**< SDA pin bit mask. */
+    struct dht_data data;           /**< Data of last successful measurement. */
+} __attribute__((__packed__));
+
+/** Sensors in DHT_SDA_PINS order. */
+extern struct dht_sensor dht_sensors[DHT_SENSORS];
 
 void dht_init(void);
 
-enum dht_read_status dht_read(void);
+/**
+ * Start measurement of sensor in background. Does nothing if measurement is
+ * already in progress.
+ *
+ * @param channel Sensor index.
+ */
+void dht_start(uint8_t channel);
+
+/**
+ * Get result of last measurement. When measurement is successfully completed,
+ * data of measured sensor hold measured values.
+ *
+ * @return DHT_BUSY while measurement is running, result of last measurement otherwise.
+ */
+enum dht_read_status dht_poll(void);
+
+/**
+ * Check if measurement is running. Result of finished one waits for dht_poll().
+ */
+bool dht_is_busy(void);
 
 #endif /* __DHT_H__ */
@@ -0,0 +1,139 @@
+/*
+ * Copyright (C) Ivo Slanina <ivo.slanina@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "common.h"
+#include "dhtstat.h"
+
+/** Reduced values of one measured quantity. */
+struct dhtstat_field {
+    int16_t median;
+    int16_t min;
+    int16_t max;
+    int16_t mean;
+};
+
+/** Temperatures of valid samples. */
+static int16_t _dhtstat_temperature[DHT_SENSORS][DHT_OVERSAMPLE];
+
+/** Humidities of valid samples. */
+static int16_t _dhtstat_humidity[DHT_SENSORS][DHT_OVERSAMPLE];
+
+/** Number of samples in window, including failed ones. */
+static uint8_t _dhtstat_samples[DHT_SENSORS];
+
+/** Number of valid samples in window. */
+static uint8_t _dhtstat_valid[DHT_SENSORS];
+
+/** Status of last sample. */
+static enum dht_read_status _dhtstat_status[DHT_SENSORS];
+
+/* Static function prototypes. */
+
+/**
+ * Sort values and reduce them.
+ *
+ * @param values Values, at least one.
+ * @param n Number of values.
+ * @param field Output reduced values.
+ */
+static void _dhtstat_reduce_field(int16_t *values, uint8_t n, struct dhtstat_field *field);
+
+/**
+ * Divide with rounding half away from zero.
+ */
+static int16_t _dhtstat_divide(int16_t sum, uint8_t n);
+
+/* Implementation. */
+
+void dhtstat_init(void) {
+    uint8_t channel;
+
+    times(DHT_SENSORS, channel) {
+        _dhtstat_samples[channel] = 0;
+        _dhtstat_valid[channel] = 0;
+    }
+}
+
+bool dhtstat_add(uint8_t channel, enum dht_read_status status, struct dht_data *data) {
+    uint8_t valid = _dhtstat_valid[channel];
+
+    if (status == DHT_OK) {
+        _dhtstat_temperature[channel][valid] = data->temperature;
+        _dhtstat_humidity[channel][valid] = data->humidity;
+        _dhtstat_valid[channel] = valid + 1;
+    }
+    _dhtstat_status[channel] = status;
+    return ++_dhtstat_samples[channel] == DHT_OVERSAMPLE;
+}
+
+enum dht_read_status dhtstat_reduce(uint8_t channel, struct dht_data *median, struct dht_stats *stats) {
+    struct dhtstat_field temperature;
+    struct dhtstat_field humidity;
+    uint8_t valid = _dhtstat_valid[channel];
+
+    _dhtstat_samples[channel] = 0;
+    _dhtstat_valid[channel] = 0;
+    if (valid == 0)
+        return _dhtstat_status[channel];
+    _dhtstat_reduce_field(_dhtstat_temperature[channel], valid, &temperature);
+    _dhtstat_reduce_field(_dhtstat_humidity[channel], valid, &humidity);
+    median->temperature = temperature.median;
+    median->humidity = humidity.median;
+    if (stats != NULL) {
+        stats->min.temperature = temperature.min;
+        stats->min.humidity = humidity.min;
+        stats->max.temperature = temperature.max;
+        stats->max.humidity = humidity.max;
+        stats->mean.temperature = temperature.mean;
+        stats->mean.humidity = humidity.mean;
+    }
+    return DHT_OK;
+}
+
+static void _dhtstat_reduce_field(int16_t *values, uint8_t n, struct dhtstat_field *field) {
+    /* DHT22 range is -40 to 125 degrees and 0 to 100 %, 16 samples fit 16 bits. */
+    int16_t sum = 0;
+    int16_t value;
+    uint8_t i;
+    uint8_t j;
+
+    /* Insertion sort, window is a few samples long. */
+    for (i = 0; i < n; i++) {
+        value = values[i];
+        sum += value;
+        for (j = i; j > 0 && values[j - 1] > value; j--)
+            values[j] = values[j - 1];
+        values[j] = value;
+    }
+    field->min = values[0];
+    field->max = values[n - 1];
+    field->mean = _dhtstat_divide(sum, n);
+    /* Even window takes mean of two middle values. */
+    if (n & 1)
+        field->median = values[n / 2];
+    else
+        field->median = _dhtstat_divide(values[n / 2 - 1] + values[n / 2], 2);
+}
+
+static int16_t _dhtstat_divide(int16_t sum, uint8_t n) {
+    if (sum < 0)
+        return (sum - n / 2) / n;
+    return (sum + n / 2) / n;
+}
@@ -0,0 +1,75 @@
+/*
+ * Copyright (C) Ivo Slanina <ivo.slanina@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __DHTSTAT_H__
+#define __DHTSTAT_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "config.h"
+#include "dht.h"
+
+/*
+ * Oversampling windows, one per sensor. Sensor is read DHT_OVERSAMPLE times per
+ * publish period and window is reduced to median, minimum, maximum and mean of valid samples.
+ * Only integer arithmetic is used, values stay in tenths.
+ */
+
+#if DHT_OVERSAMPLE < 1 || DHT_OVERSAMPLE > 16
+#error "DHT_OVERSAMPLE must be in range 1 to 16"
+#endif
+
+#if MQTT_PUBLISH_PERIOD < 2 * DHT_OVERSAMPLE
+#error "DHT22 needs at least 2 seconds between readings, lower DHT_OVERSAMPLE"
+#endif
+
+/**
+ * Aggregated statistics of window.
+ */
+struct dht_stats {
+    struct dht_data min;
+    struct dht_data max;
+    struct dht_data mean;           /**< Rounded to nearest tenth. */
+};
+
+/**
+ * Initiate empty windows.
+ */
+void dhtstat_init(void);
+
+/**
+ * Add sample to window. Failed samples only count towards window length.
+ *
+ * @param channel Sensor index.
+ * @param status Measurement status.
+ * @param data Measured data, valid only with DHT_OK status.
+ * @return True if window is complete.
+ */
+bool dhtstat_add(uint8_t channel, enum dht_read_status status, struct dht_data *data);
+
+/**
+ * Reduce complete window and start empty one.
+ *
+ * @param channel Sensor index.
+ * @param median Output median of valid samples.
+ * @param stats Output statistics of valid samples, can be NULL.
+ * @return DHT_OK if window has at least one valid sample, status of last
+ *         sample otherwise.
+ */
+enum dht_read_status dhtstat_reduce(uint8_t channel, struct dht_data *median, struct dht_stats *stats);
+
+#endif
@@ -18,13 +18,22 @@
 //*****************************************************************************
 
 #include <avr/io.h>
+#include <avr/interrupt.h>
 #include <util/delay.h>
 #include "../common.h"
 #include "../config.h"
 #include "enc28j60.h"
 
+#if ENC28J60_SPI_STATS
+#define enc28j60_assert_cs()                                    \
+    do {                                                        \
+        enc28j60_spi_stats.transactions++;                      \
+        ENC28J60_CONTROL_PORT &= ~(_BV(ENC28J60_CONTROL_CS));   \
+    } while (0)
+#else
 #define enc28j60_assert_cs() \
     ENC28J60_CONTROL_PORT &= ~(_BV(ENC28J60_CONTROL_CS))
+#endif
 
 #define enc28j60_release_cs() \
     ENC28J60_CONTROL_PORT |= _BV(ENC28J60_CONTROL_CS)
@@ -34,6 +43,55 @@
 
 static uint8_t enc28j60_bank;
 static uint16_t enc28j60_packet_ptr;
+/** Buffer address of last frame read by enc28j60_packet_read(). */
+static uint16_t enc28j60_rx_frame;
+/** Frame handed over to transmit logic, its result wasn't checked yet. */
+static uint8_t enc28j60_tx_pending;
+/** Late collision retries of pending frame. */
+static uint8_t enc28j60_tx_retries;
+
+#if ENC28J60_SPI_STATS
+struct enc28j60_spi_stats enc28j60_spi_stats;
+/** Transaction counter at start of frame being received and sent. */
+static uint32_t enc28j60_rx_transactions;
+static uint32_t enc28j60_tx_transactions;
+#endif
+
+#if ENC28J60_TX_STATS
+struct enc28j60_tx_stats enc28j60_tx_stats;
+/** End of frame in transmit buffer, transmit status vector follows it. */
+static uint16_t enc28j60_tx_end;
+#endif
+
+/**
+ * Wrap address past end of receive buffer to its start.
+ */
+static uint16_t enc28j60_rx_wrap(uint16_t address);
+
+/**
+ * Wait for pending frame to leave, at most ENC28J60_TX_TIMEOUT.
+ */
+static void enc28j60_tx_complete(void);
+
+/**
+ * Handle end of pending frame. Aborted frame is reset and sent again after
+ * late collision, stalled one is dropped.
+ *
+ * @param eir EIR_TXIF and EIR_TXERIF flags, 0 when transmit timed out.
+ */
+static void enc28j60_tx_done(uint8_t eir);
+
+static void enc28j60_write_bank(struct enc28j60_reg_write *writes, uint8_t count, uint8_t bank, uint8_t common);
+
+#if ENC28J60_INT
+/**
+ * Set on falling edge of INT pin. Packet counter is read over SPI only when
+ * this flag is set.
+ */
+static volatile uint8_t enc28j60_rx_pending;
+
+static void enc28j60_int_init(void);
+#endif
 
 uint8_t enc28j60_op_read(uint8_t op, uint8_t address) {
     uint8_t data;
@@ -65,40 +123,124 @@ void enc28j60_op_write(uint8_t op, uint8_t address, uint8_t data) {
     enc28j60_release_cs();
 }
 
+/*
+ * Burst transfers keep SPI shifting while CPU handles previous byte. SPDR is
+ * single buffered on transmit, but received byte stays readable until next
+ * transfer completes. Loop body runs while current byte is shifted out, so
+ * only the wait for SPIF is left between bytes.
+ */
+
 void enc28j60_buffer_read(uint16_t len, uint8_t *data) {
+    uint8_t byte;
+
     enc28j60_assert_cs();
     /* Issue read command. */
     SPDR = ENC28J60_READ_BUF_MEM;
     enc28j60_loop_spi_transmission_complete();
-    while (len--) {
-        /* Read data. */
+    if (len > 0) {
+        /* Clock in first byte. */
         SPDR = 0x00;
+        while (--len) {
+            enc28j60_loop_spi_transmission_complete();
+            byte = SPDR;
+            /* Start next byte before storing this one. */
+            SPDR = 0x00;
+            *data++ = byte;
+        }
         enc28j60_loop_spi_transmission_complete();
-        *data++ = SPDR;
+        *data = SPDR;
     }
     enc28j60_release_cs();
 }
 
 void enc28j60_buffer_write(uint16_t len, uint8_t *data) {
+    uint8_t byte;
+
     enc28j60_assert_cs();
     /* Issue write command. */
     SPDR = ENC28J60_WRITE_BUF_MEM;
-    enc28j60_loop_spi_transmission_complete();
     while (len--) {
-        /* Write data. */
-        SPDR = *data++;
+        /* Load next byte while previous one is shifted out. */
+        byte = *data++;
         enc28j60_loop_spi_transmission_complete();
+        SPDR = byte;
     }
+    enc28j60_loop_spi_transmission_complete();
     enc28j60_release_cs();
 }
 
+void enc28j60_mem_read(uint16_t address, uint16_t len, uint8_t *data) {
+    enc28j60_write(ERDPTL, address & 0xff);
+    enc28j60_write(ERDPTH, address >> 8);
+    enc28j60_buffer_read(len, data);
+}
+
+void enc28j60_mem_write(uint16_t address, uint16_t len, uint8_t *data) {
+    enc28j60_write(EWRPTL, address & 0xff);
+    enc28j60_write(EWRPTH, address >> 8);
+    enc28j60_buffer_write(len, data);
+}
+
+#if ENC28J60_SPI_BENCH
+void enc28j60_spi_bench(uint16_t len, uint8_t *data, struct enc28j60_spi_cycles *cycles) {
+    uint8_t tccr1b = TCCR1B;
+
+    /* Normal mode, no prescaler. 600 bytes at fosc/4 still fit 16 bits. */
+    TCCR1B = _BV(CS10);
+    TCNT1 = 0;
+    enc28j60_mem_write(TXSTART_INIT, len, data);
+    cycles->write = TCNT1;
+    TCNT1 = 0;
+    enc28j60_mem_read(TXSTART_INIT, len, data);
+    cycles->read = TCNT1;
+    TCCR1B = tccr1b;
+    TCNT1 = 0;
+    TIFR1 = _BV(OCF1A);
+}
+#endif
+
 void enc28j60_bank_set(uint8_t address) {
+    uint8_t bank = address & BANK_MASK;
+    uint8_t clear;
+    uint8_t set;
+
+    /* Registers EIE to ECON1 are mapped into all banks. */
+    if ((address & ADDR_MASK) >= EIE)
+        return;
     /* Set the bank (if needed). */
-    if ((address & BANK_MASK) != enc28j60_bank) {
-        /* Set the bank. */
-        enc28j60_op_write(ENC28J60_BIT_FIELD_CLR, ECON1, (ECON1_BSEL1 | ECON1_BSEL0));
-        enc28j60_op_write(ENC28J60_BIT_FIELD_SET, ECON1, (address & BANK_MASK) >> 5);
-        enc28j60_bank = (address & BANK_MASK);
+    if (bank != enc28j60_bank) {
+        /* Touch only bank select bits which differ, e.g. bank 0 to 1 is single set. */
+        clear = (enc28j60_bank & ~bank) >> 5;
+        set = (bank & ~enc28j60_bank) >> 5;
+        if (clear)
+            enc28j60_op_write(ENC28J60_BIT_FIELD_CLR, ECON1, clear);
+        if (set)
+            enc28j60_op_write(ENC28J60_BIT_FIELD_SET, ECON1, set);
+        enc28j60_bank = bank;
+    }
+}
+
+void enc28j60_write_batch(struct enc28j60_reg_write *writes, uint8_t count) {
+    uint8_t current = enc28j60_bank;
+    uint8_t bank;
+
+    /* Current bank and common registers need no switch, other banks follow. */
+    enc28j60_write_bank(writes, count, current, 1);
+    for (bank = 0; bank <= BANK_MASK; bank += 0x20) {
+        if (bank != current)
+            enc28j60_write_bank(writes, count, bank, 0);
+    }
+}
+
+static void enc28j60_write_bank(struct enc28j60_reg_write *writes, uint8_t count, uint8_t bank, uint8_t common) {
+    for (; count > 0; count--, writes++) {
+        if ((writes->address & ADDR_MASK) >= EIE) {
+            if (!common)
+                continue;
+        } else if ((writes->address & BANK_MASK) != bank) {
+            continue;
+        }
+        enc28j60_write(writes->address, writes->data);
     }
 }
 
@@ -143,55 +285,89 @@ void enc28j60_phy_write(uint8_t address, uint16_t data) {
 }
 
 void enc28j60_init(void) {
+    struct enc28j60_reg_write setup[] = {
+        /*
+         * Do bank 0 stuff.
+         * Initialize receive buffer.
+         * 16-bit transfers, must write low byte first.
+         * Set receive buffer start address.
+         */
+        { ERXSTL, RXSTART_INIT & 0xFF },
+        { ERXSTH, RXSTART_INIT >> 8 },
+        /* set receive pointer address. */
+        { ERXRDPTL, RXSTART_INIT & 0xFF },
+        { ERXRDPTH, RXSTART_INIT >> 8 },
+        /* Set receive buffer end. ERXND defaults to 0x1FFF (end of ram). */
+        { ERXNDL, RXSTOP_INIT & 0xFF },
+        { ERXNDH, RXSTOP_INIT >> 8 },
+        /* Set transmit buffer start. ETXST defaults to 0x0000 (beginnging of ram). */
+        { ETXSTL, TXSTART_INIT & 0xFF },
+        { ETXSTH, TXSTART_INIT >> 8 },
+        /* Do bank 2 stuff. Enable MAC receive. */
+        { MACON1, MACON1_MARXEN | MACON1_TXPAUS | MACON1_RXPAUS },
+        /* Bring MAC out of reset. */
+        { MACON2, 0x00 },
+        /*
+         * Enable automatic padding and CRC operations. MACON3 is zero after
+         * reset, bit field set doesn't work on MAC registers anyway.
+         */
+        { MACON3, MACON3_PADCFG0 | MACON3_TXCRCEN | MACON3_FRMLNEN },
+        /* Set inter-frame gap (non-back-to-back). */
+        { MAIPGL, 0x12 },
+        { MAIPGH, 0x0C },
+        /* Set inter-frame gap (back-to-back). */
+        { MABBIPG, 0x12 },
+        /* Set the maximum packet size which the controller will accept. */
+        { MAMXFLL, MAX_FRAMELEN & 0xFF },
+        { MAMXFLH, MAX_FRAMELEN >> 8 },
+    };
+
     enc28j60_spi_init();
     /* Perform system reset. */
     enc28j60_op_write(ENC28J60_SOFT_RESET, 0, ENC28J60_SOFT_RESET);
+    /* Reset selects bank 0. */
+    enc28j60_bank = 0;
+    enc28j60_tx_pending = 0;
     /* Check CLKRDY bit to see if reset is complete. */
     _delay_us(50);
     while (!(enc28j60_read(ESTAT) & ESTAT_CLKRDY));
-    /*
-     * Do bank 0 stuff.
-     * Initialize receive buffer.
-     * 16-bit transfers, must write low byte first.
-     * Set receive buffer start address.
-     */
     enc28j60_packet_ptr = RXSTART_INIT;
-    enc28j60_write(ERXSTL, RXSTART_INIT & 0xFF);
-    enc28j60_write(ERXSTH, RXSTART_INIT >> 8);
-    /* set receive pointer address. */
-    enc28j60_write(ERXRDPTL, RXSTART_INIT & 0xFF);
-    enc28j60_write(ERXRDPTH, RXSTART_INIT >> 8);
-    /* Set receive buffer end. ERXND defaults to 0x1FFF (end of ram). */
-    enc28j60_write(ERXNDL, RXSTOP_INIT & 0xFF);
-    enc28j60_write(ERXNDH, RXSTOP_INIT >> 8);
-    /* Set transmit buffer start. ETXST defaults to 0x0000 (beginnging of ram). */
-    enc28j60_write(ETXSTL, TXSTART_INIT & 0xFF);
-    enc28j60_write(ETXSTH, TXSTART_INIT >> 8);
-    /* Do bank 2 stuff. Enable MAC receive. */
-    enc28j60_write(MACON1, MACON1_MARXEN | MACON1_TXPAUS | MACON1_RXPAUS);
-    /* Bring MAC out of reset. */
-    enc28j60_write(MACON2, 0x00);
-    /* Enable automatic padding and CRC operations. */
-    enc28j60_op_write(ENC28J60_BIT_FIELD_SET, MACON3, MACON3_PADCFG0 | MACON3_TXCRCEN | MACON3_FRMLNEN);
-    /* Set inter-frame gap (non-back-to-back). */
-    enc28j60_write(MAIPGL, 0x12);
-    enc28j60_write(MAIPGH, 0x0C);
-    /* Set inter-frame gap (back-to-back). */
-    enc28j60_write(MABBIPG, 0x12);
-    /* Set the maximum packet size which the controller will accept. */
-    enc28j60_write(MAMXFLL, MAX_FRAMELEN & 0xFF);
-    enc28j60_write(MAMXFLH, MAX_FRAMELEN >> 8);
+    enc28j60_write_batch(setup, sizeof(setup) / sizeof(setup[0]));
     enc28j60_set_mac();
     /* No loopback of transmitted frames. */
     enc28j60_phy_write(PHCON2, PHCON2_HDLDIS);
-    /* Switch to bank 0. */
-    enc28j60_bank_set(ECON1);
     /* Enable interrutps. */
     enc28j60_op_write(ENC28J60_BIT_FIELD_SET, EIE, EIE_INTIE | EIE_PKTIE);
+#if ENC28J60_INT
+    enc28j60_int_init();
+#endif
     /* Enable packet reception. */
     enc28j60_op_write(ENC28J60_BIT_FIELD_SET, ECON1, ECON1_RXEN);
 }
 
+#if ENC28J60_INT
+static void enc28j60_int_init(void) {
+    /* INT is open drain output of ENC28J60, active low. */
+    ENC28J60_INT_DDR &= ~(_BV(ENC28J60_INT_PIN));
+    ENC28J60_INT_PORT |= _BV(ENC28J60_INT_PIN);
+    /* Falling edge. INT stays low while any packet is pending. */
+    EICRA = (EICRA & ~(_BV(ENC28J60_INT_ISC0) | _BV(ENC28J60_INT_ISC1))) | _BV(ENC28J60_INT_ISC1);
+    /* Clear stale flag, INTFn has the same bit position as INTn. */
+    EIFR = _BV(ENC28J60_INT_MASK);
+    EIMSK |= _BV(ENC28J60_INT_MASK);
+    /* Check packet counter once, edge might have come before. */
+    enc28j60_rx_pending = 1;
+}
+
+ISR(ENC28J60_INT_vect) {
+    enc28j60_rx_pending = 1;
+}
+
+uint8_t enc28j60_rx_is_pending(void) {
+    return enc28j60_rx_pending;
+}
+#endif
+
 void enc28j60_spi_init(void) {
     /* Initialize I/O. */
     ENC28J60_CONTROL_DDR |= _BV(ENC28J60_CONTROL_CS);
@@ -205,6 +381,10 @@ void enc28j60_spi_init(void) {
     ENC28J60_SPI_DDR &= ~(_BV(ENC28J60_SPI_MISO));
     /* Enable SPI, master mode. */
     SPCR = _BV(SPE) | _BV(MSTR);
+#if ENC28J60_SPI_2X
+    /* Double speed, fosc/2. ENC28J60 accepts SPI clock up to 20 MHz. */
+    SPSR |= _BV(SPI2X);
+#endif
 }
 
 void enc28j60_set_mac(void) {
@@ -221,9 +401,15 @@ void enc28j60_set_mac(void) {
     enc28j60_write(MAADR0, ETH_ADDR5);
 }
 
-void enc28j60_packet_send(uint16_t len1, uint8_t *packet1, uint16_t len2, uint8_t *packet2) {
-    enc28j60_op_write(ENC28J60_BIT_FIELD_SET, ECON1, ECON1_TXRST);
-    enc28j60_op_write(ENC28J60_BIT_FIELD_CLR, ECON1, ECON1_TXRST);
+void enc28j60_packet_write(uint16_t len1, uint8_t *packet1, uint16_t len2, uint8_t *packet2) {
+#if ENC28J60_SPI_STATS
+    enc28j60_tx_transactions = enc28j60_spi_stats.transactions;
+#endif
+    /* Previous frame must be out before its buffer is overwritten. */
+    enc28j60_tx_complete();
+#if ENC28J60_TX_STATS
+    enc28j60_tx_end = TXSTART_INIT + len1 + len2;
+#endif
     /* Set the write pointer to start of transmit buffer area. */
     enc28j60_write(EWRPTL, TXSTART_INIT & 0xff);
     enc28j60_write(EWRPTH, TXSTART_INIT >> 8);
@@ -236,13 +422,37 @@ void enc28j60_packet_send(uint16_t len1, uint8_t *packet1, uint16_t len2, uint8_
     enc28j60_buffer_write(len1, packet1);
     if (len2 > 0)
         enc28j60_buffer_write(len2, packet2);
+}
+
+void enc28j60_packet_transmit(void) {
+    enc28j60_op_write(ENC28J60_BIT_FIELD_CLR, EIR, EIR_TXIF | EIR_TXERIF);
     /* Send the contents of the transmit buffer onto the network. */
     enc28j60_op_write(ENC28J60_BIT_FIELD_SET, ECON1, ECON1_TXRTS);
+    enc28j60_tx_pending = 1;
+    enc28j60_tx_retries = 0;
+#if ENC28J60_SPI_STATS
+    enc28j60_spi_stats.tx_frame = enc28j60_spi_stats.transactions - enc28j60_tx_transactions;
+#endif
 }
 
-uint16_t enc28j60_packet_receive(uint16_t maxlen, uint8_t *packet) {
-    uint16_t rxstat;
-    uint16_t len;
+void enc28j60_packet_send(uint16_t len1, uint8_t *packet1, uint16_t len2, uint8_t *packet2) {
+    enc28j60_packet_write(len1, packet1, len2, packet2);
+    enc28j60_packet_transmit();
+}
+
+uint16_t enc28j60_packet_peek(uint16_t len, uint8_t *packet) {
+    uint8_t header[6];
+    uint16_t framelen;
+#if ENC28J60_INT
+    /* No SPI traffic while INT pin is idle. */
+    if (!enc28j60_rx_pending)
+        return 0;
+    /* Clear before reading counter, so that edge from now on is not lost. */
+    enc28j60_rx_pending = 0;
+#endif
+#if ENC28J60_SPI_STATS
+    enc28j60_rx_transactions = enc28j60_spi_stats.transactions;
+#endif
     /* Check if a packet has been received and buffered. */
     if (!enc28j60_read(EPKTCNT))
         return 0;
@@ -250,19 +460,30 @@ uint16_t enc28j60_packet_receive(uint16_t maxlen, uint8_t *packet) {
     /* Set the read pointer to the start of the received packet. */
     enc28j60_write(ERDPTL, (enc28j60_packet_ptr));
     enc28j60_write(ERDPTH, (enc28j60_packet_ptr) >> 8);
-    /* Read the next packet pointer. */
-    enc28j60_packet_ptr  = enc28j60_op_read(ENC28J60_READ_BUF_MEM, 0);
-    enc28j60_packet_ptr |= enc28j60_op_read(ENC28J60_READ_BUF_MEM, 0) << 8;
-    /* Read the packet length. */
-    len  = enc28j60_op_read(ENC28J60_READ_BUF_MEM, 0);
-    len |= enc28j60_op_read(ENC28J60_READ_BUF_MEM, 0) << 8;
-    /* Read the receive status. */
-    rxstat  = enc28j60_op_read(ENC28J60_READ_BUF_MEM, 0);
-    rxstat |= enc28j60_op_read(ENC28J60_READ_BUF_MEM, 0) << 8;
-    /* Limit retrieve length (we reduce the MAC-reported length by 4 to remove the CRC). */
-    len = min(len, maxlen);
-    /* Copy the packet from the receive buffer. */
+    /* Frame itself follows the header. */
+    enc28j60_rx_frame = enc28j60_rx_wrap(enc28j60_packet_ptr + sizeof(header));
+    /* Next packet pointer, packet length and receive status in single burst. */
+    enc28j60_buffer_read(sizeof(header), header);
+    enc28j60_packet_ptr = header[0] | (header[1] << 8);
+    framelen = header[2] | (header[3] << 8);
+    /* Copy beginning of the packet from the receive buffer. */
+    enc28j60_buffer_read(min(len, framelen), packet);
+    return framelen;
+}
+
+void enc28j60_packet_continue(uint16_t len, uint8_t *packet) {
+    /* Read pointer stays where enc28j60_packet_peek() stopped. */
     enc28j60_buffer_read(len, packet);
+}
+
+uint16_t enc28j60_packet_read(uint16_t maxlen, uint8_t *packet) {
+    uint16_t len = enc28j60_packet_peek(maxlen, packet);
+
+    /* Limit retrieve length (we reduce the MAC-reported length by 4 to remove the CRC). */
+    return min(len, maxlen);
+}
+
+void enc28j60_packet_release(void) {
     /*
      * Move the RX read pointer to the start of the next received packet. This frees
      * the memory we just read out.
@@ -271,5 +492,142 @@ uint16_t enc28j60_packet_receive(uint16_t maxlen, uint8_t *packet) {
     enc28j60_write(ERXRDPTH, (enc28j60_packet_ptr) >> 8);
     /* Decrement the packet counter indicate we are done with this packet. */
     enc28j60_op_write(ENC28J60_BIT_FIELD_SET, ECON2, ECON2_PKTDEC);
+#if ENC28J60_INT
+    /* INT doesn't go high while more packets wait, so no new edge comes. Check counter next time. */
+    enc28j60_rx_pending = 1;
+#endif
+#if ENC28J60_SPI_STATS
+    enc28j60_spi_stats.rx_frame = enc28j60_spi_stats.transactions - enc28j60_rx_transactions;
+#endif
+}
+
+uint16_t enc28j60_packet_receive(uint16_t maxlen, uint8_t *packet) {
+    uint16_t len = enc28j60_packet_read(maxlen, packet);
+
+    if (len > 0)
+        enc28j60_packet_release();
     return len;
 }
+
+void enc28j60_rx_filter(uint8_t filters, uint8_t *mask, uint16_t checksum) {
+    struct enc28j60_reg_write setup[] = {
+        /* Pattern window starts at destination address. */
+        { EPMOL, 0 },
+        { EPMOH, 0 },
+        { EPMM0, mask[0] },
+        { EPMM1, mask[1] },
+        { EPMM2, mask[2] },
+        { EPMM3, mask[3] },
+        { EPMM4, mask[4] },
+        { EPMM5, mask[5] },
+        { EPMM6, mask[6] },
+        { EPMM7, mask[7] },
+        { EPMCSL, checksum & 0xff },
+        { EPMCSH, checksum >> 8 },
+        { ERXFCON, filters },
+    };
+
+    enc28j60_write_batch(setup, sizeof(setup) / sizeof(setup[0]));
+}
+
+uint16_t enc28j60_rx_address(uint16_t offset) {
+    return enc28j60_rx_wrap(enc28j60_rx_frame + offset);
+}
+
+uint16_t enc28j60_tx_address(uint16_t offset) {
+    /* Skip per-packet control byte. */
+    return TXSTART_INIT + 1 + offset;
+}
+
+uint16_t enc28j60_dma_checksum(uint16_t address, uint16_t len) {
+    uint16_t end = address + len - 1;
+    struct enc28j60_reg_write setup[4];
+
+    /* DMA wraps at end of receive buffer, so must the end pointer. */
+    if (address >= RXSTART_INIT)
+        end = enc28j60_rx_wrap(end);
+    setup[0].address = EDMASTL;
+    setup[0].data = address & 0xff;
+    setup[1].address = EDMASTH;
+    setup[1].data = address >> 8;
+    setup[2].address = EDMANDL;
+    setup[2].data = end & 0xff;
+    setup[3].address = EDMANDH;
+    setup[3].data = end >> 8;
+    enc28j60_write_batch(setup, sizeof(setup) / sizeof(setup[0]));
+    enc28j60_op_write(ENC28J60_BIT_FIELD_SET, ECON1, ECON1_CSUMEN | ECON1_DMAST);
+    /* Controller clears DMAST when checksum is ready. */
+    while (enc28j60_read(ECON1) & ECON1_DMAST);
+    enc28j60_op_write(ENC28J60_BIT_FIELD_CLR, ECON1, ECON1_CSUMEN);
+    return (enc28j60_read(EDMACSH) << 8) | enc28j60_read(EDMACSL);
+}
+
+void enc28j60_tx_poll(void) {
+    uint8_t eir;
+
+    if (!enc28j60_tx_pending)
+        return;
+    eir = enc28j60_read(EIR) & (EIR_TXIF | EIR_TXERIF);
+    if (eir)
+        enc28j60_tx_done(eir);
+}
+
+static void enc28j60_tx_complete(void) {
+    uint16_t timeout = ENC28J60_TX_TIMEOUT / ENC28J60_TX_POLL;
+    uint8_t eir;
+
+    while (enc28j60_tx_pending) {
+        eir = enc28j60_read(EIR) & (EIR_TXIF | EIR_TXERIF);
+        if (eir) {
+            enc28j60_tx_done(eir);
+        } else if (timeout-- == 0) {
+            /* Transmit logic can stall after abort in half duplex (errata). */
+            enc28j60_tx_done(0);
+        } else {
+            _delay_us(ENC28J60_TX_POLL);
+        }
+    }
+}
+
+static void enc28j60_tx_done(uint8_t eir) {
+    uint8_t estat = 0;
+#if ENC28J60_TX_STATS
+    uint8_t tsv[4];
+
+    /* Status vector is written only when transmission ends. Collision count is in bits 19:16. */
+    if (eir) {
+        enc28j60_mem_read(enc28j60_tx_end + 1, sizeof(tsv), tsv);
+        enc28j60_tx_stats.collisions += tsv[2] & 0x0f;
+    }
+#endif
+    if (eir == EIR_TXIF) {
+        enc28j60_tx_pending = 0;
+        return;
+    }
+    /* Aborted or stalled, only now transmit logic needs reset. */
+    if (eir)
+        estat = enc28j60_read(ESTAT);
+    enc28j60_op_write(ENC28J60_BIT_FIELD_SET, ECON1, ECON1_TXRST);
+    enc28j60_op_write(ENC28J60_BIT_FIELD_CLR, ECON1, ECON1_TXRST);
+    enc28j60_op_write(ENC28J60_BIT_FIELD_CLR, EIR, EIR_TXIF | EIR_TXERIF);
+    enc28j60_op_write(ENC28J60_BIT_FIELD_CLR, ESTAT, ESTAT_TXABRT | ESTAT_LATECOL);
+#if ENC28J60_TX_STATS
+    enc28j60_tx_stats.aborts++;
+#endif
+    /* Frame hit by late collision is sent again (errata), other aborts are left to TCP. */
+    if (!(estat & ESTAT_LATECOL) || enc28j60_tx_retries++ == ENC28J60_TX_RETRIES) {
+        enc28j60_tx_pending = 0;
+        return;
+    }
+#if ENC28J60_TX_STATS
+    enc28j60_tx_stats.retries++;
+#endif
+    /* Frame is still in transmit buffer. */
+    enc28j60_op_write(ENC28J60_BIT_FIELD_SET, ECON1, ECON1_TXRTS);
+}
+
+static uint16_t enc28j60_rx_wrap(uint16_t address) {
+    if (address > RXSTOP_INIT)
+        return address - (RXSTOP_INIT - RXSTART_INIT + 1);
+    return address;
+}
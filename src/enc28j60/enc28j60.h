@@ -65,6 +65,15 @@
 #define ECON1_RXEN      0x04
 #define ECON1_BSEL1     0x02
 #define ECON1_BSEL0     0x01
+// ENC28J60 ERXFCON Register Bit Definitions
+#define ERXFCON_UCEN    0x80
+#define ERXFCON_ANDOR   0x40
+#define ERXFCON_CRCEN   0x20
+#define ERXFCON_PMEN    0x10
+#define ERXFCON_MPEN    0x08
+#define ERXFCON_HTEN    0x04
+#define ERXFCON_MCEN    0x02
+#define ERXFCON_BCEN    0x01
 // ENC28J60 MACON1 Register Bit Definitions
 #define MACON1_LOOPBK   0x10
 #define MACON1_TXPAUS   0x08
@@ -126,12 +135,16 @@
 #define ENC28J60_SOFT_RESET     0xFF
 
 // buffer boundaries applied to internal 8K ram
-//  entire available packet buffer space is allocated
 #define TXSTART_INIT    0x0000  // start TX buffer at 0
 #define RXSTART_INIT    0x0600  // give TX buffer space for one full ethernet frame (~1500 bytes)
-#define RXSTOP_INIT     0x1FFF  // receive buffer gets the rest
+#define RXSTOP_INIT     0x17FF  // receive buffer gets 4.5K, must be odd
+#define STORESTART_INIT 0x1800  // last 2K is left to application, see store.h
+#define STORESTOP_INIT  0x1FFF
 
 #define MAX_FRAMELEN    1518    // maximum ethernet frame length
+#define ENC28J60_TX_RETRIES 16      // sending attempts after late collision
+#define ENC28J60_TX_TIMEOUT 4000    // microseconds next frame waits before stalled transmit is reset
+#define ENC28J60_TX_POLL    10      // microseconds between EIR polls while waiting
 
 // Ethernet constants
 #define ETHERNET_MIN_PACKET_LENGTH  0x3C
@@ -202,9 +215,67 @@ void enc28j60_buffer_read(uint16_t len, uint8_t *data);
 //! write the packet buffer memory
 void enc28j60_buffer_write(uint16_t len, uint8_t *data);
 
+//! read buffer memory from given address
+void enc28j60_mem_read(uint16_t address, uint16_t len, uint8_t *data);
+
+//! write buffer memory at given address
+void enc28j60_mem_write(uint16_t address, uint16_t len, uint8_t *data);
+
+//! CPU cycles spent by buffer memory transfer, see enc28j60_spi_bench()
+struct enc28j60_spi_cycles {
+    uint16_t write;     ///< Writing data into transmit buffer area.
+    uint16_t read;      ///< Reading them back.
+};
+
+//! measure buffer memory transfer of len bytes in CPU cycles
+/// Timer1 runs from CPU clock during measurement, its setup is restored
+/// afterwards. Call it with interrupts disabled. Transmit buffer area is
+/// overwritten.
+void enc28j60_spi_bench(uint16_t len, uint8_t *data, struct enc28j60_spi_cycles *cycles);
+
 //! set the register bank for register at address
 void enc28j60_bank_set(uint8_t address);
 
+//! set receive filters
+/// \param filters  ERXFCON bits.
+/// \param mask     Pattern match mask EPMM0 - EPMM7, bit n selects frame byte n.
+/// \param checksum Expected checksum of selected bytes, as computed by enc28j60_dma_checksum().
+void enc28j60_rx_filter(uint8_t filters, uint8_t *mask, uint16_t checksum);
+
+//! control register write, see enc28j60_write_batch()
+struct enc28j60_reg_write {
+    uint8_t address;
+    uint8_t data;
+};
+
+//! write control registers grouped by bank
+/// Common registers and registers of current bank are written first, then
+/// the other banks, so each bank is selected at most once. Order of writes
+/// within one bank is kept, e.g. low byte before high byte.
+void enc28j60_write_batch(struct enc28j60_reg_write *writes, uint8_t count);
+
+//! SPI transaction counters, see ENC28J60_SPI_STATS
+struct enc28j60_spi_stats {
+    uint32_t transactions;  ///< All transactions since start.
+    uint16_t rx_frame;      ///< Transactions of last received frame.
+    uint16_t tx_frame;      ///< Transactions of last sent frame.
+};
+
+#if ENC28J60_SPI_STATS
+extern struct enc28j60_spi_stats enc28j60_spi_stats;
+#endif
+
+//! transmit counters, see ENC28J60_TX_STATS
+struct enc28j60_tx_stats {
+    uint16_t collisions;    ///< Collisions of all frames.
+    uint16_t aborts;        ///< Frames aborted by controller or stalled.
+    uint16_t retries;       ///< Frames sent again after late collision.
+};
+
+#if ENC28J60_TX_STATS
+extern struct enc28j60_tx_stats enc28j60_tx_stats;
+#endif
+
 //! read ax88796 register
 uint8_t enc28j60_read(uint8_t address);
 
@@ -232,6 +303,19 @@ void enc28j60_set_mac(void);
 /// \param packet2  Pointer to the secound packet data, can be NULL.
 void enc28j60_packet_send(uint16_t len1, uint8_t *packet1, uint16_t len2, uint8_t *packet2);
 
+//! write packet into transmit buffer without sending it
+/// Same as enc28j60_packet_send(), frame can be modified with
+/// enc28j60_mem_write() before enc28j60_packet_transmit().
+void enc28j60_packet_write(uint16_t len1, uint8_t *packet1, uint16_t len2, uint8_t *packet2);
+
+//! send packet written by enc28j60_packet_write()
+void enc28j60_packet_transmit(void);
+
+//! check whether sent frame left, without waiting for it
+/// Result of frame is otherwise checked only when next one is written.
+/// Handles late collision retry and transmit statistics early.
+void enc28j60_tx_poll(void);
+
 //! Packet receive function.
 /// Gets a packet from the network receive buffer, if one is available.
 /// The packet will by headed by an ethernet header.
@@ -240,5 +324,39 @@ void enc28j60_packet_send(uint16_t len1, uint8_t *packet1, uint16_t len2, uint8_
 /// \return Packet length in bytes if a packet was retrieved, zero otherwise.
 uint16_t enc28j60_packet_receive(uint16_t maxlen, uint8_t *packet);
 
+//! read packet, but keep it in receive buffer
+/// Same as enc28j60_packet_receive(), frame stays in buffer memory until
+/// enc28j60_packet_release() is called, which must follow nonzero return.
+uint16_t enc28j60_packet_read(uint16_t maxlen, uint8_t *packet);
+
+//! read beginning of packet, but keep it in receive buffer
+/// Reads at most len bytes. Rest of the packet can be read by
+/// enc28j60_packet_continue(), enc28j60_packet_release() must follow
+/// nonzero return.
+/// \return Packet length as reported by MAC, zero if there is no packet.
+uint16_t enc28j60_packet_peek(uint16_t len, uint8_t *packet);
+
+//! read next len bytes of packet after enc28j60_packet_peek()
+void enc28j60_packet_continue(uint16_t len, uint8_t *packet);
+
+//! free packet read by enc28j60_packet_read() or enc28j60_packet_peek()
+void enc28j60_packet_release(void);
+
+#if ENC28J60_INT
+//! check if INT signalled frame which enc28j60_packet_peek() didn't look for yet
+uint8_t enc28j60_rx_is_pending(void);
+#endif
+
+//! buffer address of byte at offset in packet read by enc28j60_packet_read() or enc28j60_packet_peek()
+uint16_t enc28j60_rx_address(uint16_t offset);
+
+//! buffer address of byte at offset in packet written by enc28j60_packet_write()
+uint16_t enc28j60_tx_address(uint16_t offset);
+
+//! compute Internet checksum of buffer memory by DMA
+/// Range can wrap around end of receive buffer.
+/// \return Complement of one's complement sum, high byte goes first on wire.
+uint16_t enc28j60_dma_checksum(uint16_t address, uint16_t len);
+
 #endif
 //@}
@@ -1,20 +1,175 @@
 #include <avr/io.h>
+#include <stddef.h>
+#include <string.h>
 #include <util/delay.h>
 #include "../uip/uip.h"
+#include "../uip/uiparp.h"
 #include "enc28j60.h"
 #include "network.h"
+#include "../common.h"
 
-inline uint16_t network_read(void) {
-    return enc28j60_packet_receive(UIP_BUFSIZE, uip_buf);
+/** Length of frame seen by network_peek() and how much of it was read. */
+static uint16_t _network_rx_len;
+static uint8_t _network_rx_peeked;
+
+#if ENC28J60_CSUM_OFFLOAD
+#define BUF ((struct uip_tcpip_hdr *)&uip_buf[UIP_LLH_LEN])
+
+/** Offset of TCP header in frame. */
+#define NETWORK_TCP_OFFSET  (UIP_LLH_LEN + UIP_IPH_LEN)
+
+/** Result of uip_tcpchksum_input() computed by ENC28J60, if valid. */
+static uint16_t _network_rx_tcpchksum;
+static uint8_t _network_rx_tcpchksum_valid;
+
+/**
+ * Let ENC28J60 checksum TCP segment of received frame, still in its buffer.
+ *
+ * @param len Frame length.
+ */
+static void _network_rx_offload(uint16_t len);
+
+/**
+ * Let ENC28J60 checksum TCP segment of frame in transmit buffer and write
+ * the result into the frame.
+ */
+static void _network_tx_offload(void);
+
+/**
+ * Get TCP segment length of IPv4 frame in uip_buf.
+ *
+ * @param len Frame length.
+ * @return Segment length, 0 if it is not whole TCP segment.
+ */
+static uint16_t _network_tcp_length(uint16_t len);
+
+/**
+ * One's complement sum of TCP pseudo header in uip_buf.
+ *
+ * @param tcplen Segment length.
+ */
+static uint16_t _network_pseudo_sum(uint16_t tcplen);
+
+/**
+ * One's complement addition.
+ */
+static inline uint16_t _network_sum_add(uint16_t sum, uint16_t value);
+#endif
+
+uint16_t network_peek(uint8_t *header, uint8_t len) {
+    /* Main loop polls here, finish sent frame so that next send doesn't wait. */
+    enc28j60_tx_poll();
+    _network_rx_len = enc28j60_packet_peek(len, header);
+    _network_rx_peeked = min(len, _network_rx_len);
+    return _network_rx_len;
+}
+
+uint16_t network_read(uint8_t *header) {
+    uint16_t len = min(_network_rx_len, UIP_BUFSIZE);
+
+    /* Headers are read already, continue where network_peek() stopped. */
+    memcpy(uip_buf, header, _network_rx_peeked);
+    if (len > _network_rx_peeked)
+        enc28j60_packet_continue(len - _network_rx_peeked, &uip_buf[_network_rx_peeked]);
+#if ENC28J60_CSUM_OFFLOAD
+    _network_rx_tcpchksum_valid = 0;
+    _network_rx_offload(len);
+#endif
+    enc28j60_packet_release();
+    return len;
+}
+
+void network_drop(void) {
+    enc28j60_packet_release();
 }
 
 void network_send(void) {
     if (uip_len <= UIP_LLH_LEN + 40)
-        enc28j60_packet_send(uip_len, uip_buf, 0, 0);
+        enc28j60_packet_write(uip_len, uip_buf, 0, 0);
     else
-        enc28j60_packet_send(54, uip_buf , uip_len - UIP_LLH_LEN - 40, uip_appdata);
+        enc28j60_packet_write(54, uip_buf , uip_len - UIP_LLH_LEN - 40, uip_appdata);
+#if ENC28J60_CSUM_OFFLOAD
+    _network_tx_offload();
+#endif
+    enc28j60_packet_transmit();
+}
+
+#if ENC28J60_CSUM_OFFLOAD
+uint16_t uip_tcpchksum(void) {
+    uint16_t tcplen = (BUF->len[0] << 8) + BUF->len[1] - UIP_IPH_LEN;
+
+    if (tcplen < ENC28J60_CSUM_OFFLOAD_MIN)
+        return uip_tcpchksum_soft();
+    /*
+     * uIP stores complement of this, which leaves pseudo header sum in
+     * checksum field. Controller adds the rest in _network_tx_offload().
+     */
+    return ~htons(_network_pseudo_sum(tcplen));
+}
+
+uint16_t uip_tcpchksum_input(void) {
+    if (_network_rx_tcpchksum_valid)
+        return _network_rx_tcpchksum;
+    return uip_tcpchksum_soft();
+}
+
+static void _network_rx_offload(uint16_t len) {
+    uint16_t tcplen = _network_tcp_length(len);
+    uint16_t sum;
+
+    if (tcplen < ENC28J60_CSUM_OFFLOAD_MIN)
+        return;
+    sum = ~enc28j60_dma_checksum(enc28j60_rx_address(NETWORK_TCP_OFFSET), tcplen);
+    sum = _network_sum_add(sum, _network_pseudo_sum(tcplen));
+    _network_rx_tcpchksum = (sum == 0) ? 0xffff : htons(sum);
+    _network_rx_tcpchksum_valid = 1;
+}
+
+static void _network_tx_offload(void) {
+    uint16_t tcplen = _network_tcp_length(uip_len);
+    uint16_t sum;
+    uint8_t chksum[2];
+
+    /* Same condition as in uip_tcpchksum(). */
+    if (tcplen < ENC28J60_CSUM_OFFLOAD_MIN)
+        return;
+    sum = enc28j60_dma_checksum(enc28j60_tx_address(NETWORK_TCP_OFFSET), tcplen);
+    chksum[0] = sum >> 8;
+    chksum[1] = sum & 0xff;
+    enc28j60_mem_write(enc28j60_tx_address(UIP_LLH_LEN + offsetof(struct uip_tcpip_hdr, tcpchksum)), sizeof(chksum), chksum);
+}
+
+static uint16_t _network_tcp_length(uint16_t len) {
+    uint16_t iplen;
+
+    if (len < UIP_LLH_LEN + UIP_IPTCPH_LEN ||
+            ((struct uip_eth_hdr *) &uip_buf[0])->type != HTONS(UIP_ETHTYPE_IP) ||
+            BUF->vhl != 0x45 || BUF->proto != UIP_PROTO_TCP)
+        return 0;
+    iplen = (BUF->len[0] << 8) + BUF->len[1];
+    if (iplen < UIP_IPTCPH_LEN || UIP_LLH_LEN + iplen > len)
+        return 0;
+    return iplen - UIP_IPH_LEN;
 }
 
+static uint16_t _network_pseudo_sum(uint16_t tcplen) {
+    /* Protocol and length, this addition cannot carry. */
+    uint16_t sum = tcplen + UIP_PROTO_TCP;
+    uint8_t i;
+
+    times(2, i) {
+        sum = _network_sum_add(sum, ntohs(BUF->srcipaddr[i]));
+        sum = _network_sum_add(sum, ntohs(BUF->destipaddr[i]));
+    }
+    return sum;
+}
+
+static inline uint16_t _network_sum_add(uint16_t sum, uint16_t value) {
+    sum += value;
+    return (sum < value) ? sum + 1 : sum;
+}
+#endif
+
 void network_init(void) {
     /* Initialize the device. */
     enc28j60_init();
@@ -27,6 +182,23 @@ void network_init(void) {
                             PHLCON_STRCH);
 }
 
+void network_set_filter(uint8_t broadcast) {
+    /*
+     * Pattern selects destination address, EtherType and ARP target IP
+     * address (bytes 0 - 5, 12 - 13 and 38 - 41).
+     */
+    uint8_t mask[8] = { 0x3f, 0x30, 0x00, 0x00, 0xc0, 0x03, 0x00, 0x00 };
+    uint8_t pattern[12] = { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x08, 0x06 };
+
+    if (broadcast) {
+        enc28j60_rx_filter(ERXFCON_UCEN | ERXFCON_CRCEN | ERXFCON_BCEN, mask, 0);
+        return;
+    }
+    memcpy(&pattern[8], &uip_hostaddr, sizeof(uip_hostaddr));
+    enc28j60_rx_filter(ERXFCON_UCEN | ERXFCON_CRCEN | ERXFCON_PMEN, mask,
+            ~ntohs(uip_chksum((uint16_t *) pattern, sizeof(pattern))));
+}
+
 void network_get_MAC(uint8_t *macaddr) {
     // read MAC address registers
     // NOTE: MAC address in ENC28J60 is byte-backward
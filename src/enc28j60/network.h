@@ -14,17 +14,46 @@ void network_init(void);
 void network_init_mac(uint8_t *macaddr);
 
 /**
- * Read from the network, returns number of read bytes
+ * Read beginning of received frame, frame stays in ENC28J60 buffer.
  *
- * @return
+ * Must be followed by network_read() or network_drop() when a frame is
+ * returned.
+ *
+ * @param header Buffer for beginning of the frame.
+ * @param len Size of header buffer.
+ * @return Frame length, 0 if nothing was received.
+ */
+uint16_t network_peek(uint8_t *header, uint8_t len);
+
+/**
+ * Read frame seen by network_peek() into uip_buf.
+ *
+ * @param header Beginning of the frame filled by network_peek().
+ * @return Number of bytes in uip_buf.
+ */
+uint16_t network_read(uint8_t *header);
+
+/**
+ * Discard frame seen by network_peek() without reading it.
  */
-inline uint16_t network_read(void);
+void network_drop(void);
 
 /**
  * Send using the network
  */
 void network_send(void);
 
+/**
+ * Set receive filter of ENC28J60.
+ *
+ * Unicast frames for our MAC address are always accepted. Broadcast frames
+ * are accepted when requested, e.g. during DHCP, otherwise only ARP
+ * requests for our IP address pass.
+ *
+ * @param broadcast Accept all broadcast frames.
+ */
+void network_set_filter(uint8_t broadcast);
+
 /**
  * Sets the MAC address of the device
  *
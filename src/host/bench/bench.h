@@ -0,0 +1,59 @@
+/*
+ * Copyright (C) Ivo Slanina <ivo.slanina@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Helpers for host microbenchmarks.
+ *
+ * Cycle counts are host CPU cycles. They are only meaningful relative to each
+ * other, e.g. when comparing two implementations of the same routine.
+ */
+
+#ifndef __BENCH_H__
+#define __BENCH_H__
+
+#include <stdint.h>
+#include <stdio.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define bench_cycles()  __rdtsc()
+#else
+#include <time.h>
+static inline uint64_t bench_cycles(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+#endif
+
+/**
+ * Print one result line.
+ *
+ * @param name Benchmark name.
+ * @param cycles Total cycles.
+ * @param bytes Total bytes processed.
+ */
+static inline void bench_report(const char *name, uint64_t cycles, uint64_t bytes) {
+    printf("%-40s %8.2f cycles/byte\n", name, (double) cycles / bytes);
+}
+
+/** Keep compiler from optimizing away benchmarked results. */
+static inline void bench_consume(const void *p) {
+    __asm__ volatile("" : : "r" (p) : "memory");
+}
+
+#endif
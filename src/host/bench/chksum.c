@@ -0,0 +1,149 @@
+/*
+ * Copyright (C) Ivo Slanina <ivo.slanina@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * uIP Internet checksum: portable C kernel checked against RFC 1071
+ * reference on random buffers of all lengths and alignments, then timed.
+ * AVR assembly kernel is not built on host, CONFIG_CHKSUM_SELFTEST runs
+ * uip_chksum_selftest() on target for it. Self-test itself is run here too.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include "../../common.h"
+#include "../../uip/uip.h"
+#include "bench.h"
+
+#define CHKSUM_BENCH_SIZE       600
+#define CHKSUM_BENCH_ROUNDS     200000
+#define CHKSUM_CHECK_ROUNDS     20
+
+/**
+ * RFC 1071 reference: 32-bit accumulator, carries folded at the end.
+ *
+ * @return Sum in network byte order, like uip_chksum().
+ */
+static uint16_t _reference_chksum(const uint8_t *data, uint16_t len) {
+    uint32_t sum = 0;
+
+    while (len > 1) {
+        sum += (data[0] << 8) | data[1];
+        data += 2;
+        len -= 2;
+    }
+    if (len > 0)
+        sum += data[0] << 8;
+    while (sum >> 16)
+        sum = (sum & 0xffff) + (sum >> 16);
+    return htons(sum);
+}
+
+/**
+ * Fill buffer with random bytes, biased to 0x00 and 0xff to hit carry edge cases.
+ */
+static void _fill(uint8_t *data, uint16_t len) {
+    uint16_t i;
+
+    times(len, i) {
+        switch (rand() % 4) {
+            case 0:
+                data[i] = 0x00;
+                break;
+            case 1:
+                data[i] = 0xff;
+                break;
+            default:
+                data[i] = rand();
+                break;
+        }
+    }
+}
+
+/**
+ * Compare uip_chksum() with reference for every length and 4 alignments.
+ *
+ * @return Number of mismatches.
+ */
+static uint32_t _check(void) {
+    static uint8_t data[CHKSUM_BENCH_SIZE + 4];
+    uint32_t errors = 0;
+    uint16_t len;
+    uint16_t expected;
+    uint16_t actual;
+    uint8_t offset;
+    uint8_t round;
+
+    srand(1071);
+    times(CHKSUM_CHECK_ROUNDS, round) {
+        for (len = 0; len <= CHKSUM_BENCH_SIZE; len++) {
+            times(4, offset) {
+                _fill(data + offset, len);
+                expected = _reference_chksum(data + offset, len);
+                actual = uip_chksum((uint16_t *) (data + offset), len);
+                if (actual != expected) {
+                    if (errors++ == 0)
+                        printf("mismatch: len %u offset %u: 0x%04x != 0x%04x\n",
+                                len, offset, actual, expected);
+                }
+            }
+        }
+    }
+    return errors;
+}
+
+static uint64_t _bench_run(uint16_t (*chksum)(const uint8_t *, uint16_t), const uint8_t *data, uint64_t *bytes) {
+    volatile uint16_t sum;
+    uint64_t start;
+    uint32_t i;
+
+    start = bench_cycles();
+    for (i = 0; i < CHKSUM_BENCH_ROUNDS; i++)
+        sum = chksum(data, CHKSUM_BENCH_SIZE);
+    (void) sum;
+    *bytes = (uint64_t) CHKSUM_BENCH_ROUNDS * CHKSUM_BENCH_SIZE;
+    return bench_cycles() - start;
+}
+
+static uint16_t _uip_chksum(const uint8_t *data, uint16_t len) {
+    return uip_chksum((uint16_t *) data, len);
+}
+
+int main(void) {
+    static uint8_t data[CHKSUM_BENCH_SIZE];
+    uint32_t errors;
+    uint64_t cycles;
+    uint64_t bytes;
+
+    printf("uip_chksum, %d byte buffer\n", CHKSUM_BENCH_SIZE);
+    errors = _check();
+    if (errors > 0) {
+        printf("uip_chksum: %u mismatches against RFC 1071 reference\n", errors);
+        return 1;
+    }
+    errors = uip_chksum_selftest();
+    if (errors > 0) {
+        printf("uip_chksum_selftest: %u mismatches\n", errors);
+        return 1;
+    }
+
+    _fill(data, sizeof(data));
+    cycles = _bench_run(_reference_chksum, data, &bytes);
+    bench_report("RFC 1071 reference", cycles, bytes);
+    cycles = _bench_run(_uip_chksum, data, &bytes);
+    bench_report("uip_chksum", cycles, bytes);
+    return 0;
+}
@@ -0,0 +1,116 @@
+/*
+ * Copyright (C) Ivo Slanina <ivo.slanina@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * uMQTT circular buffer throughput: block copy implementation against the
+ * former byte-by-byte one. Chunks up to UMQTT_CIRC_SMALL take the direct
+ * pointer path and should stay on par with the baseline, longer ones should
+ * win by the memcpy() speedup.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include "../../common.h"
+#include "../../umqtt/umqtt.h"
+#include "bench.h"
+
+#define CIRC_BENCH_SIZE         150
+#define CIRC_BENCH_ROUNDS       200000
+
+/* Former byte-by-byte implementation, kept as baseline. */
+
+static int16_t _bytewise_push(struct umqtt_circ_buffer *buff, uint8_t *data, int16_t len) {
+    uint8_t *bend = buff->start + buff->length - 1;
+    uint8_t *dend = (buff->pointer - buff->start + buff->datalen) % buff->length + buff->start;
+
+    for (; len > 0; len--) {
+        if (dend > bend)
+            dend = buff->start;
+        if (buff->datalen != 0 && dend == buff->pointer)
+            break;
+        *dend = *data;
+        dend++;
+        data++;
+        buff->datalen++;
+    }
+    return len;
+}
+
+static int16_t _bytewise_pop(struct umqtt_circ_buffer *buff, uint8_t *data, int16_t len) {
+    uint8_t *bend = buff->start + buff->length - 1;
+    int16_t i;
+
+    for (i = 0; i < len && buff->datalen > 0; i++) {
+        data[i] = *buff->pointer;
+        buff->pointer++;
+        buff->datalen--;
+        if (buff->pointer > bend)
+            buff->pointer = buff->start;
+    }
+    return i;
+}
+
+typedef int16_t (*circ_op)(struct umqtt_circ_buffer *, uint8_t *, int16_t);
+
+/**
+ * Push chunks and pop them at a different chunk size, so that copies wrap
+ * around the end of buffer at varying offsets.
+ */
+static uint64_t _bench_run(circ_op push, circ_op pop, int16_t chunk, uint64_t *bytes) {
+    static uint8_t storage[CIRC_BENCH_SIZE];
+    uint8_t in[CIRC_BENCH_SIZE];
+    uint8_t out[CIRC_BENCH_SIZE];
+    struct umqtt_circ_buffer buff = {
+        .start = storage,
+        .length = sizeof(storage),
+    };
+    uint64_t start;
+    uint32_t i;
+
+    memset(in, 0x5a, sizeof(in));
+    umqtt_circ_init(&buff);
+    *bytes = 0;
+
+    start = bench_cycles();
+    for (i = 0; i < CIRC_BENCH_ROUNDS; i++) {
+        *bytes += chunk - push(&buff, in, chunk);
+        if (umqtt_circ_datalen(&buff) > CIRC_BENCH_SIZE / 2)
+            *bytes += pop(&buff, out, chunk + 3);
+        bench_consume(out);
+    }
+    return bench_cycles() - start;
+}
+
+int main(void) {
+    static const int16_t chunks[] = {1, 2, 8, 32, 64};
+    char name[64];
+    uint64_t cycles;
+    uint64_t bytes;
+    uint8_t i;
+
+    printf("umqtt_circ push/pop, %d byte ring, UMQTT_CIRC_POW2=%d\n", CIRC_BENCH_SIZE, UMQTT_CIRC_POW2);
+    iterate(chunks, i) {
+        cycles = _bench_run(_bytewise_push, _bytewise_pop, chunks[i], &bytes);
+        snprintf(name, sizeof(name), "bytewise, %d byte chunks", chunks[i]);
+        bench_report(name, cycles, bytes);
+
+        cycles = _bench_run(umqtt_circ_push, umqtt_circ_pop, chunks[i], &bytes);
+        snprintf(name, sizeof(name), "block copy, %d byte chunks", chunks[i]);
+        bench_report(name, cycles, bytes);
+    }
+    return 0;
+}
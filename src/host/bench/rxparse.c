@@ -0,0 +1,106 @@
+/*
+ * Copyright (C) Ivo Slanina <ivo.slanina@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * uMQTT incoming packet parser: packets whose remaining length ends inside
+ * a fixed length field must not stall the parser. Each malformed packet is
+ * followed by PINGRESP, which has to be recognized again. Streams are fed
+ * whole and byte by byte.
+ */
+
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "../../common.h"
+#include "../../umqtt/umqtt.h"
+
+/** Seconds before parser is considered stuck. */
+#define RXPARSE_TIMEOUT         2
+
+struct rxparse_case {
+    const char *name;
+    uint8_t len;
+    uint8_t data[8];
+};
+
+static const struct rxparse_case _cases[] = {
+    {"PUBLISH, topic length cut",       5, {0x30, 0x01, 0x00, 0xd0, 0x00}},
+    {"PUBLISH, empty body",             4, {0x30, 0x00, 0xd0, 0x00}},
+    {"PUBLISH QoS 1, message id cut",   8, {0x32, 0x04, 0x00, 0x01, 'a', 0x00, 0xd0, 0x00}},
+    {"CONNACK, reason code cut",        5, {0x20, 0x01, 0x00, 0xd0, 0x00}},
+    {"PUBACK, message id cut",          5, {0x40, 0x01, 0x00, 0xd0, 0x00}},
+};
+
+static void _rxparse_timeout(int sig) {
+    static const char msg[] = "umqtt rx parser stuck\n";
+
+    (void) sig;
+    /* Only async-signal-safe calls here. */
+    (void) !write(STDERR_FILENO, msg, sizeof(msg) - 1);
+    _exit(1);
+}
+
+/**
+ * Feed one stream to fresh connection.
+ *
+ * @param c Test case.
+ * @param chunk Bytes pushed before each umqtt_process() call.
+ * @return True when parser ends idle with PINGRESP seen.
+ */
+static bool _rxparse_run(const struct rxparse_case *c, uint8_t chunk) {
+    static uint8_t rxstorage[16];
+    static uint8_t txstorage[16];
+    struct umqtt_connection conn = {
+        .rxbuff = {.start = rxstorage, .length = sizeof(rxstorage)},
+        .txbuff = {.start = txstorage, .length = sizeof(txstorage)},
+    };
+    uint8_t data[sizeof(c->data)];
+    uint8_t i;
+
+    umqtt_circ_init(&conn.rxbuff);
+    umqtt_circ_init(&conn.txbuff);
+    umqtt_init(&conn);
+    conn.nack_ping = 1;
+
+    memcpy(data, c->data, c->len);
+    for (i = 0; i < c->len; i += chunk) {
+        umqtt_circ_push(&conn.rxbuff, data + i, min(chunk, c->len - i));
+        umqtt_process(&conn);
+    }
+    return conn.rx_state == UMQTT_RX_HEADER && conn.nack_ping == 0;
+}
+
+int main(void) {
+    uint8_t failed = 0;
+    uint8_t i;
+
+    signal(SIGALRM, _rxparse_timeout);
+    alarm(RXPARSE_TIMEOUT);
+
+    printf("umqtt rx parser, truncated fields\n");
+    iterate(_cases, i) {
+        if (!_rxparse_run(&_cases[i], _cases[i].len) || !_rxparse_run(&_cases[i], 1)) {
+            printf("%-40s FAILED\n", _cases[i].name);
+            failed++;
+        } else {
+            printf("%-40s ok\n", _cases[i].name);
+        }
+    }
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,52 @@
+/*
+ * Copyright (C) Ivo Slanina <ivo.slanina@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Host replacement of Timer1 based time keeping.
+ *
+ * Ticks are derived from the monotonic system clock so timers expire at the
+ * same CLOCK_SECOND rate as on the board.
+ */
+
+#include <time.h>
+#include "../uip/clock.h"
+
+static clock_time_t offset;
+
+/**
+ * Read monotonic system clock in clock ticks.
+ */
+static clock_time_t _clock_host_ticks(void);
+
+void clock_init(void) {
+    offset = _clock_host_ticks();
+}
+
+clock_time_t clock_time(void) {
+    return _clock_host_ticks() - offset;
+}
+
+void clock_set(clock_time_t t) {
+    offset = _clock_host_ticks() - t;
+}
+
+static clock_time_t _clock_host_ticks(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * CLOCK_SECOND + ts.tv_nsec / (1000000000L / CLOCK_SECOND);
+}
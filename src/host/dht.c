@@ -0,0 +1,75 @@
+/*
+ * Copyright (C) Ivo Slanina <ivo.slanina@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Host replacement of DHT-22 driver.
+ *
+ * Produces slowly drifting measurements instead of sampling the sensor.
+ * Measurement completes immediately in dht_start().
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include "../common.h"
+#include "../dht.h"
+
+/** Initial temperature in tenths of degree Celsius. */
+#define DHT_HOST_TEMPERATURE    215
+/** Initial relative humidity in tenths of percent. */
+#define DHT_HOST_HUMIDITY       450
+
+struct dht_sensor dht_sensors[DHT_SENSORS];
+
+/** Result of last measurement. */
+static enum dht_read_status _dht_status = DHT_BUSY;
+
+/**
+ * Random step of -1, 0 or +1 tenth.
+ */
+static int8_t _dht_host_step(void);
+
+void dht_init(void) {
+    uint8_t channel;
+
+    /* Each sensor starts one degree and five percent apart. */
+    times(DHT_SENSORS, channel) {
+        dht_sensors[channel].data.temperature = DHT_HOST_TEMPERATURE + channel * 10;
+        dht_sensors[channel].data.humidity = DHT_HOST_HUMIDITY + channel * 50;
+    }
+}
+
+void dht_start(uint8_t channel) {
+    struct dht_data *data = &dht_sensors[channel].data;
+    int16_t humidity = data->humidity + _dht_host_step();
+
+    data->temperature += _dht_host_step();
+    data->humidity = min(max(humidity, 0), 1000);
+    _dht_status = DHT_OK;
+}
+
+enum dht_read_status dht_poll(void) {
+    return _dht_status;
+}
+
+bool dht_is_busy(void) {
+    return false;
+}
+
+static int8_t _dht_host_step(void) {
+    return (rand() % 3) - 1;
+}
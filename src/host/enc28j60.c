@@ -0,0 +1,399 @@
+/*
+ * Copyright (C) Ivo Slanina <ivo.slanina@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Host replacement of ENC28J60 driver.
+ *
+ * Control registers, PHY registers and buffer memory are kept in RAM.
+ * Ethernet frames are exchanged with a Linux TAP interface, named by the
+ * ENC28J60_TAP environment variable (default "tap0"). When the interface
+ * can't be opened the node runs with link down: frames sent are dropped and
+ * nothing is ever received.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/if.h>
+#include <linux/if_tun.h>
+#include "../common.h"
+#include "../config.h"
+#include "../enc28j60/enc28j60.h"
+#include "../enc28j60/network.h"
+
+/** Default TAP interface name. */
+#define ENC28J60_HOST_TAP       "tap0"
+/** Size of ENC28J60 buffer memory. */
+#define ENC28J60_HOST_RAM_SIZE  0x2000
+/** Address where received frames are kept, frames never wrap. */
+#define ENC28J60_HOST_RX_FRAME  (RXSTART_INIT + 6)
+
+/** Control registers of all banks, indexed by bank and address bits. */
+static uint8_t enc28j60_regs[BANK_MASK + ADDR_MASK + 1];
+
+/** PHY registers. */
+static uint16_t enc28j60_phy_regs[0x20];
+
+/** Buffer memory. */
+static uint8_t enc28j60_ram[ENC28J60_HOST_RAM_SIZE];
+
+/** TAP file descriptor, -1 if link is down. */
+static int enc28j60_tap = -1;
+
+/**
+ * Map register address to enc28j60_regs index.
+ *
+ * @param address Register address with bank bits.
+ */
+static inline uint8_t _enc28j60_reg_index(uint8_t address);
+
+/**
+ * Read 16-bit pointer from register pair.
+ *
+ * @param address Address of low byte register.
+ */
+static uint16_t _enc28j60_pointer_get(uint8_t address);
+
+/**
+ * Write 16-bit pointer to register pair.
+ *
+ * @param address Address of low byte register.
+ * @param value Pointer value.
+ */
+static void _enc28j60_pointer_set(uint8_t address, uint16_t value);
+
+/**
+ * Open TAP interface.
+ */
+static void _enc28j60_tap_open(void);
+
+/**
+ * Apply receive filters of ERXFCON like the chip does. AND mode, magic
+ * packet and hash table filters are not simulated.
+ *
+ * @param frame Received frame.
+ * @param len Frame length.
+ * @return Non-zero if frame is accepted.
+ */
+static uint8_t _enc28j60_rx_accept(const uint8_t *frame, uint16_t len);
+
+/**
+ * Add byte at given position of checksummed data to 32-bit sum.
+ */
+static inline uint32_t _enc28j60_sum_add(uint32_t sum, uint16_t index, uint8_t data);
+
+/**
+ * Fold 32-bit sum into Internet checksum.
+ */
+static uint16_t _enc28j60_sum_fold(uint32_t sum);
+
+uint8_t enc28j60_op_read(uint8_t op, uint8_t address) {
+    uint16_t ptr;
+    uint8_t data;
+
+    if (op == ENC28J60_READ_BUF_MEM) {
+        ptr = _enc28j60_pointer_get(ERDPTL);
+        data = enc28j60_ram[ptr];
+        _enc28j60_pointer_set(ERDPTL, (ptr + 1) % ENC28J60_HOST_RAM_SIZE);
+        return data;
+    }
+    return enc28j60_regs[_enc28j60_reg_index(address)];
+}
+
+void enc28j60_op_write(uint8_t op, uint8_t address, uint8_t data) {
+    uint8_t *reg = &enc28j60_regs[_enc28j60_reg_index(address)];
+    uint16_t ptr;
+
+    switch (op) {
+        case ENC28J60_WRITE_CTRL_REG:
+            *reg = data;
+            break;
+        case ENC28J60_BIT_FIELD_SET:
+            *reg |= data;
+            break;
+        case ENC28J60_BIT_FIELD_CLR:
+            *reg &= ~data;
+            break;
+        case ENC28J60_WRITE_BUF_MEM:
+            ptr = _enc28j60_pointer_get(EWRPTL);
+            enc28j60_ram[ptr] = data;
+            _enc28j60_pointer_set(EWRPTL, (ptr + 1) % ENC28J60_HOST_RAM_SIZE);
+            break;
+        case ENC28J60_SOFT_RESET:
+            memset(enc28j60_regs, 0, sizeof(enc28j60_regs));
+            enc28j60_regs[_enc28j60_reg_index(ESTAT)] = ESTAT_CLKRDY;
+            enc28j60_regs[_enc28j60_reg_index(ERXFCON)] = ERXFCON_UCEN | ERXFCON_CRCEN | ERXFCON_BCEN;
+            break;
+    }
+}
+
+void enc28j60_buffer_read(uint16_t len, uint8_t *data) {
+    while (len--)
+        *data++ = enc28j60_op_read(ENC28J60_READ_BUF_MEM, 0);
+}
+
+void enc28j60_buffer_write(uint16_t len, uint8_t *data) {
+    while (len--)
+        enc28j60_op_write(ENC28J60_WRITE_BUF_MEM, 0, *data++);
+}
+
+void enc28j60_mem_read(uint16_t address, uint16_t len, uint8_t *data) {
+    _enc28j60_pointer_set(ERDPTL, address);
+    enc28j60_buffer_read(len, data);
+}
+
+void enc28j60_mem_write(uint16_t address, uint16_t len, uint8_t *data) {
+    _enc28j60_pointer_set(EWRPTL, address);
+    enc28j60_buffer_write(len, data);
+}
+
+void enc28j60_bank_set(uint8_t address) {
+    enc28j60_op_write(ENC28J60_BIT_FIELD_CLR, ECON1, (ECON1_BSEL1 | ECON1_BSEL0));
+    enc28j60_op_write(ENC28J60_BIT_FIELD_SET, ECON1, (address & BANK_MASK) >> 5);
+}
+
+uint8_t enc28j60_read(uint8_t address) {
+    return enc28j60_op_read(ENC28J60_READ_CTRL_REG, address);
+}
+
+void enc28j60_write(uint8_t address, uint8_t data) {
+    enc28j60_op_write(ENC28J60_WRITE_CTRL_REG, address, data);
+}
+
+uint16_t enc28j60_phy_read(uint8_t address) {
+    return enc28j60_phy_regs[address & 0x1f];
+}
+
+void enc28j60_phy_write(uint8_t address, uint16_t data) {
+    enc28j60_phy_regs[address & 0x1f] = data;
+}
+
+void enc28j60_init(void) {
+    enc28j60_spi_init();
+    enc28j60_op_write(ENC28J60_SOFT_RESET, 0, ENC28J60_SOFT_RESET);
+    _enc28j60_pointer_set(ERXSTL, RXSTART_INIT);
+    _enc28j60_pointer_set(ERXRDPTL, RXSTART_INIT);
+    _enc28j60_pointer_set(ERXNDL, RXSTOP_INIT);
+    _enc28j60_pointer_set(ETXSTL, TXSTART_INIT);
+    _enc28j60_pointer_set(MAMXFLL, MAX_FRAMELEN);
+    enc28j60_set_mac();
+    enc28j60_op_write(ENC28J60_BIT_FIELD_SET, EIE, EIE_INTIE | EIE_PKTIE);
+    enc28j60_op_write(ENC28J60_BIT_FIELD_SET, ECON1, ECON1_RXEN);
+}
+
+void enc28j60_spi_init(void) {
+    _enc28j60_tap_open();
+}
+
+void enc28j60_set_mac(void) {
+    enc28j60_write(MAADR5, ETH_ADDR0);
+    enc28j60_write(MAADR4, ETH_ADDR1);
+    enc28j60_write(MAADR3, ETH_ADDR2);
+    enc28j60_write(MAADR2, ETH_ADDR3);
+    enc28j60_write(MAADR1, ETH_ADDR4);
+    enc28j60_write(MAADR0, ETH_ADDR5);
+}
+
+void enc28j60_packet_write(uint16_t len1, uint8_t *packet1, uint16_t len2, uint8_t *packet2) {
+    /* Keep a copy in the transmit buffer area just like the chip does. */
+    _enc28j60_pointer_set(EWRPTL, TXSTART_INIT);
+    _enc28j60_pointer_set(ETXNDL, TXSTART_INIT + len1 + len2);
+    enc28j60_op_write(ENC28J60_WRITE_BUF_MEM, 0, 0x00);
+    enc28j60_buffer_write(len1, packet1);
+    if (len2 > 0)
+        enc28j60_buffer_write(len2, packet2);
+}
+
+void enc28j60_packet_transmit(void) {
+    uint8_t frame[MAX_FRAMELEN];
+    uint16_t len = min(_enc28j60_pointer_get(ETXNDL) - TXSTART_INIT, MAX_FRAMELEN);
+
+    if (enc28j60_tap < 0)
+        return;
+    memcpy(frame, &enc28j60_ram[TXSTART_INIT + 1], len);
+    /* EIO just means the TAP interface is not up yet. */
+    if (write(enc28j60_tap, frame, len) < 0 && errno != EIO)
+        perror("enc28j60: tap write");
+}
+
+void enc28j60_tx_poll(void) {
+    /* Tap write is synchronous, nothing is ever pending. */
+}
+
+void enc28j60_packet_send(uint16_t len1, uint8_t *packet1, uint16_t len2, uint8_t *packet2) {
+    enc28j60_packet_write(len1, packet1, len2, packet2);
+    enc28j60_packet_transmit();
+}
+
+uint16_t enc28j60_packet_peek(uint16_t len, uint8_t *packet) {
+    uint8_t *frame = &enc28j60_ram[ENC28J60_HOST_RX_FRAME];
+    ssize_t framelen;
+
+    if (enc28j60_tap < 0)
+        return 0;
+    /* Frame goes into receive buffer area, after receive status vector. */
+    do {
+        framelen = read(enc28j60_tap, frame, MAX_FRAMELEN);
+        if (framelen < 0) {
+            if (errno != EAGAIN)
+                perror("enc28j60: tap read");
+            return 0;
+        }
+    } while (!_enc28j60_rx_accept(frame, framelen));
+    enc28j60_mem_read(ENC28J60_HOST_RX_FRAME, min(len, framelen), packet);
+    return framelen;
+}
+
+void enc28j60_packet_continue(uint16_t len, uint8_t *packet) {
+    enc28j60_buffer_read(len, packet);
+}
+
+uint16_t enc28j60_packet_read(uint16_t maxlen, uint8_t *packet) {
+    uint16_t len = enc28j60_packet_peek(maxlen, packet);
+
+    return min(len, maxlen);
+}
+
+void enc28j60_packet_release(void) {
+}
+
+uint16_t enc28j60_packet_receive(uint16_t maxlen, uint8_t *packet) {
+    uint16_t len = enc28j60_packet_read(maxlen, packet);
+
+    if (len > 0)
+        enc28j60_packet_release();
+    return len;
+}
+
+void enc28j60_rx_filter(uint8_t filters, uint8_t *mask, uint16_t checksum) {
+    uint8_t i;
+
+    _enc28j60_pointer_set(EPMOL, 0);
+    times(8, i)
+        enc28j60_write(EPMM0 + i, mask[i]);
+    _enc28j60_pointer_set(EPMCSL, checksum);
+    enc28j60_write(ERXFCON, filters);
+}
+
+uint16_t enc28j60_rx_address(uint16_t offset) {
+    return ENC28J60_HOST_RX_FRAME + offset;
+}
+
+uint16_t enc28j60_tx_address(uint16_t offset) {
+    return TXSTART_INIT + 1 + offset;
+}
+
+uint16_t enc28j60_dma_checksum(uint16_t address, uint16_t len) {
+    uint32_t sum = 0;
+    uint16_t i;
+
+    for (i = 0; i < len; i++) {
+        sum = _enc28j60_sum_add(sum, i, enc28j60_ram[address]);
+        if (++address > RXSTOP_INIT)
+            address = RXSTART_INIT;
+    }
+    return _enc28j60_sum_fold(sum);
+}
+
+static inline uint8_t _enc28j60_reg_index(uint8_t address) {
+    /* Registers 0x1B - 0x1F are common for all banks. */
+    if ((address & ADDR_MASK) >= EIE)
+        return address & ADDR_MASK;
+    return address & (BANK_MASK | ADDR_MASK);
+}
+
+static uint16_t _enc28j60_pointer_get(uint8_t address) {
+    return enc28j60_read(address) | (enc28j60_read(address + 1) << 8);
+}
+
+static void _enc28j60_pointer_set(uint8_t address, uint16_t value) {
+    enc28j60_write(address, value & 0xff);
+    enc28j60_write(address + 1, value >> 8);
+}
+
+static uint8_t _enc28j60_rx_accept(const uint8_t *frame, uint16_t len) {
+    static const uint8_t broadcast[6] = { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff };
+    uint8_t filters = enc28j60_read(ERXFCON);
+    uint8_t mac[6];
+    uint16_t offset = _enc28j60_pointer_get(EPMOL);
+    uint32_t sum = 0;
+    uint16_t selected = 0;
+    uint8_t i;
+
+    /* No filter enabled means promiscuous mode. */
+    if (!(filters & ~(ERXFCON_CRCEN | ERXFCON_ANDOR)) || len < sizeof(mac))
+        return 1;
+    network_get_MAC(mac);
+    if ((filters & ERXFCON_UCEN) && !memcmp(frame, mac, sizeof(mac)))
+        return 1;
+    if ((filters & ERXFCON_BCEN) && !memcmp(frame, broadcast, sizeof(broadcast)))
+        return 1;
+    if ((filters & ERXFCON_MCEN) && (frame[0] & 0x01) && memcmp(frame, broadcast, sizeof(broadcast)))
+        return 1;
+    if (filters & ERXFCON_PMEN) {
+        times(64, i) {
+            if (!(enc28j60_read(EPMM0 + i / 8) & (1 << (i % 8))))
+                continue;
+            if (offset + i >= len)
+                return 0;
+            sum = _enc28j60_sum_add(sum, selected++, frame[offset + i]);
+        }
+        if (_enc28j60_sum_fold(sum) == _enc28j60_pointer_get(EPMCSL))
+            return 1;
+    }
+    return 0;
+}
+
+static inline uint32_t _enc28j60_sum_add(uint32_t sum, uint16_t index, uint8_t data) {
+    return sum + ((index & 1) ? data : data << 8);
+}
+
+static uint16_t _enc28j60_sum_fold(uint32_t sum) {
+    while (sum >> 16)
+        sum = (sum & 0xffff) + (sum >> 16);
+    return ~sum;
+}
+
+static void _enc28j60_tap_open(void) {
+    struct ifreq ifr;
+    char *name = getenv("ENC28J60_TAP");
+
+    if (enc28j60_tap >= 0)
+        return;
+    if (name == NULL)
+        name = ENC28J60_HOST_TAP;
+
+    enc28j60_tap = open("/dev/net/tun", O_RDWR | O_NONBLOCK);
+    if (enc28j60_tap < 0) {
+        perror("enc28j60: /dev/net/tun");
+        return;
+    }
+
+    memset(&ifr, 0, sizeof(ifr));
+    ifr.ifr_flags = IFF_TAP | IFF_NO_PI;
+    strncpy(ifr.ifr_name, name, IFNAMSIZ - 1);
+    if (ioctl(enc28j60_tap, TUNSETIFF, &ifr) < 0) {
+        perror("enc28j60: TUNSETIFF");
+        close(enc28j60_tap);
+        enc28j60_tap = -1;
+    }
+}
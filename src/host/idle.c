@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) Ivo Slanina <ivo.slanina@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Host replacement of idle mode.
+ *
+ * There is no interrupt to wake the process, it naps for a millisecond when
+ * no work is due. Duty cycle is measured on the monotonic system clock.
+ */
+
+#include <stdint.h>
+#include <time.h>
+#include "../idle.h"
+
+/** Nap length in nanoseconds. */
+#define IDLE_HOST_NAP           1000000L
+
+/** Time spent napping in nanoseconds since last duty cycle report. */
+static uint64_t _idle_asleep;
+
+/** Start of duty cycle report window in nanoseconds. */
+static uint64_t _idle_window;
+
+/**
+ * Read monotonic system clock in nanoseconds.
+ */
+static uint64_t _idle_host_now(void);
+
+void idle_init(void) {
+    _idle_asleep = 0;
+    _idle_window = _idle_host_now();
+}
+
+void idle_sleep(clock_time_t (*remaining)(void)) {
+    struct timespec nap = { 0, IDLE_HOST_NAP };
+    uint64_t start;
+
+    if (remaining() == 0)
+        return;
+    start = _idle_host_now();
+    nanosleep(&nap, NULL);
+    _idle_asleep += _idle_host_now() - start;
+}
+
+uint16_t idle_duty_cycle(void) {
+    uint64_t now = _idle_host_now();
+    uint64_t elapsed = now - _idle_window;
+    uint64_t awake = elapsed - _idle_asleep;
+
+    _idle_window = now;
+    _idle_asleep = 0;
+    if (elapsed == 0)
+        return 1000;
+    return awake * 1000 / elapsed;
+}
+
+static uint64_t _idle_host_now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
@@ -0,0 +1,204 @@
+/*
+ * Copyright (C) Ivo Slanina <ivo.slanina@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Host replacement of avr-libc <avr/io.h>.
+ *
+ * I/O registers are backed by plain memory, so firmware code which only
+ * stores and loads port values links and runs on the build machine.
+ */
+
+#ifndef __HOST_AVR_IO_H__
+#define __HOST_AVR_IO_H__
+
+#include <stdint.h>
+
+/** Simulated data space of I/O and extended I/O registers. */
+extern volatile uint8_t host_sfr[0x100];
+
+#define _SFR_MEM8(addr)     (host_sfr[(addr)])
+#define _SFR_MEM16(addr)    (*(volatile uint16_t *) &host_sfr[(addr)])
+#define _SFR_IO8(addr)      (host_sfr[(addr) + 0x20])
+
+#define _BV(bit)            (1 << (bit))
+#define bit_is_set(sfr, bit)        ((sfr) & _BV(bit))
+#define bit_is_clear(sfr, bit)      (!((sfr) & _BV(bit)))
+#define loop_until_bit_is_set(sfr, bit)     do { } while (0)
+#define loop_until_bit_is_clear(sfr, bit)   do { } while (0)
+
+/* Port B */
+#define PINB    _SFR_IO8(0x03)
+#define DDRB    _SFR_IO8(0x04)
+#define PORTB   _SFR_IO8(0x05)
+/* Port C */
+#define PINC    _SFR_IO8(0x06)
+#define DDRC    _SFR_IO8(0x07)
+#define PORTC   _SFR_IO8(0x08)
+/* Port D */
+#define PIND    _SFR_IO8(0x09)
+#define DDRD    _SFR_IO8(0x0A)
+#define PORTD   _SFR_IO8(0x0B)
+
+/* Timer/counter 0 */
+#define TIFR0   _SFR_IO8(0x15)
+#define TCCR0A  _SFR_IO8(0x24)
+#define TCCR0B  _SFR_IO8(0x25)
+#define TCNT0   _SFR_IO8(0x26)
+#define OCR0A   _SFR_IO8(0x27)
+#define OCR0B   _SFR_IO8(0x28)
+#define TIMSK0  _SFR_MEM8(0x6E)
+/* Timer/counter 1 */
+#define TIFR1   _SFR_IO8(0x16)
+#define TIMSK1  _SFR_MEM8(0x6F)
+#define TCCR1A  _SFR_MEM8(0x80)
+#define TCCR1B  _SFR_MEM8(0x81)
+#define TCNT1   _SFR_MEM16(0x84)
+#define ICR1    _SFR_MEM16(0x86)
+#define OCR1A   _SFR_MEM16(0x88)
+/* Timer/counter 2 */
+#define TIFR2   _SFR_IO8(0x17)
+#define TIMSK2  _SFR_MEM8(0x70)
+#define TCCR2A  _SFR_MEM8(0xB0)
+#define TCCR2B  _SFR_MEM8(0xB1)
+#define TCNT2   _SFR_MEM8(0xB2)
+#define OCR2A   _SFR_MEM8(0xB3)
+#define ASSR    _SFR_MEM8(0xB6)
+/* External and pin change interrupts */
+#define PCIFR   _SFR_IO8(0x1B)
+#define EIFR    _SFR_IO8(0x1C)
+#define EIMSK   _SFR_IO8(0x1D)
+#define PCICR   _SFR_MEM8(0x68)
+#define EICRA   _SFR_MEM8(0x69)
+#define PCMSK0  _SFR_MEM8(0x6B)
+#define PCMSK1  _SFR_MEM8(0x6C)
+#define PCMSK2  _SFR_MEM8(0x6D)
+/* SPI */
+#define SPCR    _SFR_IO8(0x2C)
+#define SPSR    _SFR_IO8(0x2D)
+#define SPDR    _SFR_IO8(0x2E)
+/* Sleep and MCU control */
+#define SMCR    _SFR_IO8(0x33)
+#define MCUCR   _SFR_IO8(0x35)
+/* USART0 */
+#define UCSR0A  _SFR_MEM8(0xC0)
+#define UCSR0B  _SFR_MEM8(0xC1)
+#define UCSR0C  _SFR_MEM8(0xC2)
+#define UBRR0L  _SFR_MEM8(0xC4)
+#define UBRR0H  _SFR_MEM8(0xC5)
+#define UDR0    _SFR_MEM8(0xC6)
+
+/* TCCR0B, TCCR1B, TCCR2B */
+#define CS00    0
+#define CS01    1
+#define CS02    2
+#define CS10    0
+#define CS11    1
+#define CS12    2
+#define WGM12   3
+#define CS20    0
+#define CS21    1
+#define CS22    2
+/* TIMSKn, TIFRn */
+#define TOIE0   0
+#define TOV0    0
+#define OCIE1A  1
+#define OCF1A   1
+#define ICIE1   5
+#define TOIE2   0
+#define OCIE2A  1
+#define OCF2A   1
+/* ASSR */
+#define AS2     5
+#define TCN2UB  4
+#define OCR2AUB 3
+#define TCR2AUB 1
+#define TCR2BUB 0
+/* PCICR, EIMSK, EICRA */
+#define PCIE0   0
+#define PCIE1   1
+#define PCIE2   2
+#define INT0    0
+#define INT1    1
+#define ISC00   0
+#define ISC01   1
+#define ISC10   2
+#define ISC11   3
+/* PCMSKn */
+#define PCINT0  0
+#define PCINT1  1
+#define PCINT2  2
+#define PCINT3  3
+#define PCINT4  4
+#define PCINT5  5
+#define PCINT6  6
+#define PCINT7  7
+/* SPCR, SPSR */
+#define SPR0    0
+#define SPR1    1
+#define CPHA    2
+#define CPOL    3
+#define MSTR    4
+#define DORD    5
+#define SPE     6
+#define SPIE    7
+#define SPI2X   0
+#define SPIF    7
+/* SMCR */
+#define SE      0
+#define SM0     1
+#define SM1     2
+#define SM2     3
+/* UCSR0A, UCSR0B, UCSR0C */
+#define U2X0    1
+#define UDRE0   5
+#define TXC0    6
+#define RXC0    7
+#define TXEN0   3
+#define RXEN0   4
+#define UCSZ00  1
+#define UCSZ01  2
+#define USBS0   3
+#define UMSEL00 6
+#define UMSEL01 7
+
+#define PB0     0
+#define PB1     1
+#define PB2     2
+#define PB3     3
+#define PB4     4
+#define PB5     5
+#define PB6     6
+#define PB7     7
+
+#define PC0     0
+#define PC1     1
+#define PC2     2
+#define PC3     3
+#define PC4     4
+#define PC5     5
+#define PC6     6
+
+#define PD0     0
+#define PD1     1
+#define PD2     2
+#define PD3     3
+#define PD4     4
+#define PD5     5
+#define PD6     6
+#define PD7     7
+
+#endif
@@ -0,0 +1,43 @@
+/*
+ * Copyright (C) Ivo Slanina <ivo.slanina@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Host replacement of avr-libc <avr/pgmspace.h>.
+ *
+ * There is a single address space on the host, so program memory accessors
+ * collapse to ordinary loads.
+ */
+
+#ifndef __HOST_AVR_PGMSPACE_H__
+#define __HOST_AVR_PGMSPACE_H__
+
+#include <stdint.h>
+#include <string.h>
+
+#define PROGMEM
+#define PGM_P               const char *
+#define PGM_VOID_P          const void *
+#define PSTR(s)             (s)
+
+#define pgm_read_byte(addr) (*(const uint8_t *) (addr))
+#define pgm_read_word(addr) (*(const uint16_t *) (addr))
+#define pgm_read_ptr(addr)  (*(void * const *) (addr))
+
+#define memcpy_P(dst, src, len)     memcpy((dst), (src), (len))
+#define strlen_P(s)                 strlen((s))
+
+#endif
@@ -0,0 +1,35 @@
+/*
+ * Copyright (C) Ivo Slanina <ivo.slanina@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Host replacement of avr-libc <util/delay.h>.
+ *
+ * Busy-wait delays only pace real hardware, they are no-ops on the host.
+ */
+
+#ifndef __HOST_UTIL_DELAY_H__
+#define __HOST_UTIL_DELAY_H__
+
+static inline void _delay_ms(double ms) {
+    (void) ms;
+}
+
+static inline void _delay_us(double us) {
+    (void) us;
+}
+
+#endif
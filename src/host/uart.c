@@ -0,0 +1,41 @@
+/*
+ * Copyright (C) Ivo Slanina <ivo.slanina@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Host replacement of USART0 driver. Output goes to stderr.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include "../uart.h"
+
+void uart_init(uint16_t baudrate) {
+    (void) baudrate;
+}
+
+void uart_putc(uint8_t data) {
+    fputc(data, stderr);
+}
+
+void uart_puts(char *s) {
+    fputs(s, stderr);
+}
+
+void uart_println(char *s) {
+    uart_puts(s);
+    uart_puts("\r\n");
+}
@@ -0,0 +1,95 @@
+/*
+ * Copyright (C) Ivo Slanina <ivo.slanina@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+#include "config.h"
+#include "enc28j60/enc28j60.h"
+#include "idle.h"
+
+/** Time spent asleep in Timer1 counts since last duty cycle report. */
+static uint32_t _idle_asleep;
+
+/** Start of duty cycle report window in Timer1 counts. */
+static uint32_t _idle_window;
+
+/* Static function prototypes. */
+
+/**
+ * Get current time in Timer1 counts. Timer1 runs from F_CPU / 1024 and
+ * clears at OCR1A, one clock tick is OCR1A + 1 counts.
+ */
+static uint32_t _idle_now(void);
+
+/* Implementation. */
+
+void idle_init(void) {
+    set_sleep_mode(SLEEP_MODE_IDLE);
+    _idle_asleep = 0;
+    _idle_window = _idle_now();
+}
+
+void idle_sleep(clock_time_t (*remaining)(void)) {
+    uint32_t start;
+
+    cli();
+    if (enc28j60_rx_is_pending() || remaining() == 0) {
+        sei();
+        return;
+    }
+    start = _idle_now();
+    sleep_enable();
+    /* Instruction after sei() runs before any interrupt, wakeup can't be lost. */
+    sei();
+    sleep_cpu();
+    sleep_disable();
+    _idle_asleep += _idle_now() - start;
+}
+
+uint16_t idle_duty_cycle(void) {
+    uint32_t now = _idle_now();
+    uint32_t elapsed = now - _idle_window;
+    uint32_t awake = elapsed - _idle_asleep;
+
+    _idle_window = now;
+    _idle_asleep = 0;
+    if (elapsed == 0)
+        return 1000;
+    /* Keep awake * 1000 in 32 bits. */
+    while (elapsed > 0x3fffff) {
+        elapsed >>= 1;
+        awake >>= 1;
+    }
+    return awake * 1000 / elapsed;
+}
+
+static uint32_t _idle_now(void) {
+    uint8_t sreg = SREG;
+    clock_time_t ticks;
+    uint16_t count;
+
+    cli();
+    ticks = clock_time();
+    count = TCNT1;
+    /* Counter cleared, but compare interrupt didn't count the tick yet. */
+    if ((TIFR1 & _BV(OCF1A)) && count < OCR1A / 2)
+        ticks++;
+    SREG = sreg;
+    return ticks * (OCR1A + 1UL) + count;
+}
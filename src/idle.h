@@ -0,0 +1,61 @@
+/*
+ * Copyright (C) Ivo Slanina <ivo.slanina@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __IDLE_H__
+#define __IDLE_H__
+
+#include <stdint.h>
+#include "config.h"
+#include "uip/clock.h"
+
+/*
+ * Idle state of main loop. When no work is due, CPU sleeps in idle mode until
+ * an interrupt wakes it: Timer1 clock tick, ENC28J60 INT or DHT22 edge and
+ * timeout interrupts. Timers have clock tick resolution, so the tick ends sleep
+ * no later than at nearest timer deadline.
+ */
+
+#if CONFIG_SLEEP && !ENC28J60_INT
+#error "CONFIG_SLEEP needs ENC28J60_INT, received frames would wait for clock tick"
+#endif
+
+#if CONFIG_SLEEP_STATS && !CONFIG_SLEEP
+#error "CONFIG_SLEEP_STATS needs CONFIG_SLEEP"
+#endif
+
+/**
+ * Select sleep mode.
+ */
+void idle_init(void);
+
+/**
+ * Sleep until interrupt unless some work is due. Interrupts are disabled while
+ * pending work is checked, interrupt can't come between check and sleep.
+ *
+ * @param remaining Function returning clock ticks until nearest timer, 0 if
+ *        work is due.
+ */
+void idle_sleep(clock_time_t (*remaining)(void));
+
+/**
+ * Get duty cycle since previous call.
+ *
+ * @return Time awake in permille.
+ */
+uint16_t idle_duty_cycle(void);
+
+#endif
@@ -25,14 +25,43 @@
 #include "uip/timer.h"
 #include "nethandler.h"
 #include "dht.h"
+#include "sampler.h"
+#include "idle.h"
 #include "node.h"
 #include "uart.h"
+#if ENC28J60_SPI_BENCH || ENC28J60_SPI_STATS || CONFIG_SLEEP_STATS
+#include "enc28j60/enc28j60.h"
+#endif
+#if ENC28J60_SPI_BENCH || ENC28J60_SPI_STATS || CONFIG_SLEEP_STATS || CONFIG_CHKSUM_SELFTEST
+#include "common/fixfmt.h"
+#endif
 
 static struct timer periodic_timer;
 static struct timer arp_timer;
 
 /* Static function prototypes. */
 static void _interface_init(void);
+#if ENC28J60_SPI_BENCH && defined(__AVR__)
+static void _spi_bench(void);
+#endif
+#if ENC28J60_SPI_STATS && defined(__AVR__)
+static void _spi_stats(void);
+#endif
+#if ENC28J60_TX_STATS && defined(__AVR__)
+static void _tx_stats(void);
+#endif
+#if CONFIG_SLEEP
+static clock_time_t _remaining(void);
+#endif
+#if CONFIG_SLEEP_STATS
+static void _sleep_stats(void);
+#endif
+#if CONFIG_CHKSUM_SELFTEST
+static void _chksum_selftest(void);
+#endif
+#if ((ENC28J60_SPI_BENCH || ENC28J60_SPI_STATS || ENC28J60_TX_STATS) && defined(__AVR__)) || CONFIG_SLEEP_STATS || CONFIG_CHKSUM_SELFTEST
+static void _print_uint(char *label, uint16_t value);
+#endif
 #if !(CONFIG_DHCP)
 static void _ip_init();
 #endif
@@ -44,31 +73,152 @@ int main (void) {
     uart_init(BAUD);
     clock_init();
     dht_init();
+    sampler_init();
     network_init();
+#if ENC28J60_SPI_BENCH && defined(__AVR__)
+    _spi_bench();
+#endif
+#if CONFIG_CHKSUM_SELFTEST
+    _chksum_selftest();
+#endif
     uip_init();
     node_init();
     _interface_init();
 #if !(CONFIG_DHCP)
     _ip_init();
 #endif
+#if CONFIG_SLEEP
+    idle_init();
+#endif
 
     /* Enable interrupts. */
     sei();
 
     for (;;) {
+        /* Sensor cadence doesn't depend on network and broker state. */
+        sampler_process();
+
         nethandler_rx();
 
         if (timer_tryrestart(&periodic_timer))
             nethandler_periodic();
 
-        if (timer_tryrestart(&arp_timer))
+        if (timer_tryrestart(&arp_timer)) {
             uip_arp_timer();
+#if ENC28J60_SPI_STATS && defined(__AVR__)
+            _spi_stats();
+#endif
+#if ENC28J60_TX_STATS && defined(__AVR__)
+            _tx_stats();
+#endif
+#if CONFIG_SLEEP_STATS
+            _sleep_stats();
+#endif
+        }
 
         node_process();
+#if CONFIG_SLEEP
+        /* Everything due was done, wait for next deadline or interrupt. */
+        idle_sleep(_remaining);
+#endif
     }
     return 0;
 }
 
+#if ((ENC28J60_SPI_BENCH || ENC28J60_SPI_STATS || ENC28J60_TX_STATS) && defined(__AVR__)) || CONFIG_SLEEP_STATS || CONFIG_CHKSUM_SELFTEST
+/**
+ * Print label followed by decimal value to UART, without line end.
+ */
+static void _print_uint(char *label, uint16_t value) {
+    char number[FIXFMT_UINT_LEN + 1];
+
+    number[fixfmt_uint(number, value)] = '\0';
+    uart_puts(label);
+    uart_puts(number);
+}
+#endif
+
+#if ENC28J60_SPI_BENCH && defined(__AVR__)
+/**
+ * Print cycles of full frame transfer to and from ENC28J60 buffer memory.
+ */
+static void _spi_bench(void) {
+    struct enc28j60_spi_cycles cycles;
+
+    enc28j60_spi_bench(UIP_BUFSIZE, uip_buf, &cycles);
+    _print_uint("SPI cycles, write: ", cycles.write);
+    _print_uint(", read: ", cycles.read);
+    _print_uint(", bytes: ", UIP_BUFSIZE);
+    uart_println("");
+}
+#endif
+
+#if ENC28J60_SPI_STATS && defined(__AVR__)
+/**
+ * Print SPI transactions of last received and sent frame.
+ */
+static void _spi_stats(void) {
+    _print_uint("SPI transactions, rx frame: ", enc28j60_spi_stats.rx_frame);
+    _print_uint(", tx frame: ", enc28j60_spi_stats.tx_frame);
+    uart_println("");
+}
+#endif
+
+#if ENC28J60_TX_STATS && defined(__AVR__)
+/**
+ * Print transmit collisions, aborts and retries since start.
+ */
+static void _tx_stats(void) {
+    _print_uint("TX collisions: ", enc28j60_tx_stats.collisions);
+    _print_uint(", aborts: ", enc28j60_tx_stats.aborts);
+    _print_uint(", retries: ", enc28j60_tx_stats.retries);
+    uart_println("");
+}
+#endif
+
+#if CONFIG_SLEEP
+/**
+ * Get time until nearest timer of main loop and its tasks expires.
+ *
+ * @return Clock ticks, 0 if work is due.
+ */
+static clock_time_t _remaining(void) {
+    clock_time_t remaining = timer_remaining(&periodic_timer);
+    clock_time_t next;
+
+    next = timer_remaining(&arp_timer);
+    if (next < remaining)
+        remaining = next;
+    next = sampler_remaining();
+    if (next < remaining)
+        remaining = next;
+    next = node_remaining();
+    if (next < remaining)
+        remaining = next;
+    return remaining;
+}
+#endif
+
+#if CONFIG_SLEEP_STATS
+/**
+ * Print time awake since previous report.
+ */
+static void _sleep_stats(void) {
+    _print_uint("Duty cycle permille: ", idle_duty_cycle());
+    uart_println("");
+}
+#endif
+
+#if CONFIG_CHKSUM_SELFTEST
+/**
+ * Print checksum self-test result, uip_buf is free before uip_init().
+ */
+static void _chksum_selftest(void) {
+    _print_uint("Checksum self-test mismatches: ", uip_chksum_selftest());
+    uart_println("");
+}
+#endif
+
 static void _interface_init(void) {
     struct uip_eth_addr mac;
 
@@ -95,5 +245,6 @@ static void _ip_init() {
 
     uip_sethostaddr(&address);
     uip_setnetmask(&netmask);
+    network_set_filter(0);
 }
 #endif
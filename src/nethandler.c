@@ -21,13 +21,38 @@
 #include "common.h"
 #include "node.h"
 
+/** Ethernet, IP and TCP headers, enough to decide about a frame. */
+#define NETHANDLER_PEEK_LEN     (UIP_LLH_LEN + sizeof(struct uip_tcpip_hdr))
+/** Offset of target IP address in ARP frame. */
+#define NETHANDLER_ARP_DIPADDR  38
+/** Ethernet CRC counted in frame length reported by ENC28J60. */
+#define NETHANDLER_CRC_LEN      4
+
 /**
  * Send data out.
  */
 static inline void _nethandler_send_out(void);
 
+/**
+ * Decide from frame headers whether uIP has any use for the frame.
+ *
+ * @param header Beginning of the frame.
+ * @param len Frame length.
+ * @return Non-zero if frame should be read.
+ */
+static uint8_t _nethandler_wanted(uint8_t *header, uint16_t len);
+
 void nethandler_rx(void) {
-    uip_len = network_read();
+    uint8_t header[NETHANDLER_PEEK_LEN];
+    uint16_t len = network_peek(header, sizeof(header));
+
+    if (len == 0)
+        return;
+    if (!_nethandler_wanted(header, len)) {
+        network_drop();
+        return;
+    }
+    uip_len = network_read(header);
     if (uip_len > 0) {
         switch (ntohs(((struct uip_eth_hdr *) &uip_buf[0])->type)) {
             case UIP_ETHTYPE_IP:
@@ -68,3 +93,51 @@ static inline void _nethandler_send_out(void) {
         network_send();
     }
 }
+
+static uint8_t _nethandler_wanted(uint8_t *header, uint16_t len) {
+    struct uip_tcpip_hdr *tcpip = (struct uip_tcpip_hdr *) &header[UIP_LLH_LEN];
+    struct uip_udpip_hdr *udpip = (struct uip_udpip_hdr *) &header[UIP_LLH_LEN];
+    uint8_t i;
+
+    /*
+     * Frame longer than uip_buf would be cut short by network_read() and fail
+     * uIP length checks. Trailing CRC doesn't have to fit.
+     */
+    if (len > UIP_BUFSIZE + NETHANDLER_CRC_LEN)
+        return 0;
+    switch (ntohs(((struct uip_eth_hdr *) header)->type)) {
+        case UIP_ETHTYPE_ARP:
+            return uip_ipaddr_cmp(&header[NETHANDLER_ARP_DIPADDR], uip_hostaddr);
+        case UIP_ETHTYPE_IP:
+            break;
+        default:
+            return 0;
+    }
+    /* Frame too short for the headers, leave it to uIP. */
+    if (len < UIP_LLH_LEN + UIP_IPTCPH_LEN)
+        return 1;
+    switch (tcpip->proto) {
+        case UIP_PROTO_TCP:
+            /* Node doesn't listen, segment must belong to open connection. */
+            times(UIP_CONNS, i) {
+                if (uip_conns[i].tcpstateflags != UIP_CLOSED &&
+                        tcpip->destport == uip_conns[i].lport &&
+                        tcpip->srcport == uip_conns[i].rport &&
+                        uip_ipaddr_cmp(tcpip->srcipaddr, uip_conns[i].ripaddr))
+                    return 1;
+            }
+            return 0;
+#if UIP_UDP
+        case UIP_PROTO_UDP:
+            times(UIP_UDP_CONNS, i) {
+                if (uip_udp_conns[i].lport != 0 && udpip->destport == uip_udp_conns[i].lport)
+                    return 1;
+            }
+            return 0;
+#endif
+        case UIP_PROTO_ICMP:
+            return 1;
+        default:
+            return 0;
+    }
+}
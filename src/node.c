@@ -20,6 +20,7 @@
 #if CONFIG_DHCP
 #include "common/sectimer.h"
 #include "dhcp/dhcpclient.h"
+#include "enc28j60/network.h"
 #endif
 
 #include "uip/uip.h"
@@ -47,6 +48,8 @@ static struct sectimer dhcp_lease_sectimer;
 void node_init(void) {
 #if CONFIG_DHCP
     dhcpclient_init();
+    /* DHCP server answers to broadcast. */
+    network_set_filter(1);
 #endif
     mqttclient_init();
     update_state(NODE_STATE_INIT);
@@ -58,6 +61,7 @@ void node_process(void) {
         case NODE_DHCP_QUERYING:
             dhcpclient_process();
             if (dhcpclient_is_done()) {
+                network_set_filter(0);
                 _node_set_dhcp_lease_timer();
                 update_state(NODE_MQTT);
             }
@@ -71,6 +75,16 @@ void node_process(void) {
     }
 }
 
+clock_time_t node_remaining(void) {
+    switch (current_state) {
+        case NODE_MQTT:
+            return mqttclient_remaining();
+        default:
+            /* DHCP takes a few seconds, loop keeps polling it. */
+            return 0;
+    }
+}
+
 void node_appcall(void) {
 #if CONFIG_DHCP
     _node_test_dhcp_lease_timer();
@@ -113,6 +127,7 @@ static void _node_test_dhcp_lease_timer(void) {
             if (sectimer_tryrestart(&dhcp_lease_sectimer)) {
                 uip_close();
                 dhcpclient_init();
+                network_set_filter(1);
                 update_state(NODE_DHCP_QUERYING);
             }
             break;
@@ -20,6 +20,7 @@
 
 #include "config.h"
 #include "umqtt/umqtt.h"
+#include "uip/clock.h"
 
 #if CONFIG_DHCP
 #define NODE_STATE_INIT NODE_DHCP_QUERYING
@@ -49,4 +50,9 @@ void node_process(void);
 void node_appcall(void);
 void node_udp_appcall(void);
 
+/**
+ * @return Clock ticks until next timer of node expires, 0 if work is due.
+ */
+clock_time_t node_remaining(void);
+
 #endif
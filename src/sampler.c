@@ -0,0 +1,140 @@
+/*
+ * Copyright (C) Ivo Slanina <ivo.slanina@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "uip/timer.h"
+#include "config.h"
+#include "dht.h"
+#include "dhtstat.h"
+#include "sampler.h"
+
+/** Timer of sensor readings. */
+static struct timer _sampler_timer;
+
+/** Sensor being measured, DHT_SENSORS when round is finished. */
+static uint8_t _sampler_channel;
+
+/** Output queue. */
+static struct store_sample _sampler_queue[SAMPLER_QUEUE_LEN];
+
+/** Index of oldest measurement in queue. */
+static uint8_t _sampler_head;
+
+/** Number of measurements in queue. */
+static uint8_t _sampler_count;
+
+/* Static function prototypes. */
+
+/**
+ * Add finished reading to oversampling window, queue measurement when window
+ * is complete.
+ *
+ * @param channel Sensor index.
+ * @param status Reading status.
+ */
+static void _sampler_collect(uint8_t channel, enum dht_read_status status);
+
+/**
+ * Append measurement to output queue, oldest one is dropped when full.
+ *
+ * @param sample Measurement.
+ */
+static void _sampler_push(struct store_sample *sample);
+
+/* Implementation. */
+
+void sampler_init(void) {
+    _sampler_head = 0;
+    _sampler_count = 0;
+    _sampler_channel = DHT_SENSORS;
+    dhtstat_init();
+    timer_set(&_sampler_timer, CLOCK_SECOND * MQTT_PUBLISH_PERIOD / DHT_OVERSAMPLE);
+}
+
+void sampler_process(void) {
+    enum dht_read_status status;
+
+    if (_sampler_channel < DHT_SENSORS) {
+        status = dht_poll();
+        if (status == DHT_BUSY)
+            return;
+        _sampler_collect(_sampler_channel, status);
+        /* Next sensor is started right away, each sensor rests for whole period. */
+        if (++_sampler_channel < DHT_SENSORS) {
+            dht_start(_sampler_channel);
+            return;
+        }
+    }
+    if (!timer_expired(&_sampler_timer))
+        return;
+    /* Next reading is scheduled from previous one, main loop latency doesn't accumulate. */
+    timer_reset(&_sampler_timer);
+    if (timer_expired(&_sampler_timer)) {
+        /* Whole period was missed, give sensor full period of rest. */
+        timer_restart(&_sampler_timer);
+    }
+    _sampler_channel = 0;
+    dht_start(_sampler_channel);
+}
+
+bool sampler_pop(struct store_sample *sample) {
+    if (_sampler_count == 0)
+        return false;
+    *sample = _sampler_queue[_sampler_head];
+    if (++_sampler_head == SAMPLER_QUEUE_LEN)
+        _sampler_head = 0;
+    _sampler_count--;
+    return true;
+}
+
+clock_time_t sampler_remaining(void) {
+    if (_sampler_channel < DHT_SENSORS && !dht_is_busy())
+        return 0;
+    return timer_remaining(&_sampler_timer);
+}
+
+static void _sampler_collect(uint8_t channel, enum dht_read_status status) {
+    struct store_sample sample;
+
+    if (!dhtstat_add(channel, status, &dht_sensors[channel].data))
+        return;
+    sample.timestamp = clock_time_seconds();
+    sample.channel = channel;
+#if MQTT_PUBLISH_STATS
+    sample.status = dhtstat_reduce(channel, &sample.data, &sample.stats);
+#else
+    sample.status = dhtstat_reduce(channel, &sample.data, NULL);
+#endif
+    _sampler_push(&sample);
+}
+
+static void _sampler_push(struct store_sample *sample) {
+    uint8_t tail = _sampler_head + _sampler_count;
+
+    if (tail >= SAMPLER_QUEUE_LEN)
+        tail -= SAMPLER_QUEUE_LEN;
+    _sampler_queue[tail] = *sample;
+    if (_sampler_count == SAMPLER_QUEUE_LEN) {
+        /* Tail overwrote oldest measurement. */
+        if (++_sampler_head == SAMPLER_QUEUE_LEN)
+            _sampler_head = 0;
+    } else {
+        _sampler_count++;
+    }
+}
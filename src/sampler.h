@@ -0,0 +1,63 @@
+/*
+ * Copyright (C) Ivo Slanina <ivo.slanina@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __SAMPLER_H__
+#define __SAMPLER_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "uip/clock.h"
+#include "store.h"
+
+/*
+ * Sensor sampling task. Sensors are read at fixed cadence derived from
+ * clock_time(), independently of network and MQTT broker state. Each period
+ * starts round of readings, sensors are measured one after another without
+ * blocking. Finished measurements are queued with their timestamps until a
+ * consumer takes them.
+ */
+
+/** Capacity of output queue in measurements, two rounds of readings and some. */
+#define SAMPLER_QUEUE_LEN       (2 * DHT_SENSORS + 2)
+
+/**
+ * Initiate sampling. First reading is started after one sampling period.
+ */
+void sampler_init(void);
+
+/**
+ * Start round of readings when sampling period elapsed, collect finished
+ * readings. Call from main loop.
+ */
+void sampler_process(void);
+
+/**
+ * Remove oldest measurement from output queue. When queue is full, sampler
+ * overwrites oldest measurement.
+ *
+ * @param sample Output measurement.
+ * @return False if queue is empty.
+ */
+bool sampler_pop(struct store_sample *sample);
+
+/**
+ * @return Clock ticks until next round of readings, 0 if finished reading
+ *         waits for sampler_process().
+ */
+clock_time_t sampler_remaining(void);
+
+#endif
@@ -23,9 +23,11 @@
 #include "dhcp/dhcp.h"
 #endif
 
-#define SHAREDBUF_NODE_SEND_BUFFER_SIZE 100
 #define SHAREDBUF_NODE_UMQTT_RX_SIZE    150
-#define SHAREDBUF_NODE_UMQTT_TX_SIZE    200
+
+#if UMQTT_CIRC_POW2 && (SHAREDBUF_NODE_UMQTT_RX_SIZE & (SHAREDBUF_NODE_UMQTT_RX_SIZE - 1))
+#error "SHAREDBUF_NODE_UMQTT_RX_SIZE must be power of two when UMQTT_CIRC_POW2 is set"
+#endif
 
 #if CONFIG_DHCP
 struct sharedbuf_dhcp {
@@ -33,10 +35,9 @@ struct sharedbuf_dhcp {
 };
 #endif
 
+/* MQTT packets are encoded directly into uip_appdata, there is no TX buffer. */
 struct sharedbuf_mqtt {
-    uint8_t send_buffer[SHAREDBUF_NODE_SEND_BUFFER_SIZE];
     uint8_t mqtt_rx[SHAREDBUF_NODE_UMQTT_RX_SIZE];
-    uint8_t mqtt_tx[SHAREDBUF_NODE_UMQTT_TX_SIZE];
 };
 
 union sharedbuf_buffer {
@@ -0,0 +1,81 @@
+/*
+ * Copyright (C) Ivo Slanina <ivo.slanina@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "enc28j60/enc28j60.h"
+#include "store.h"
+
+/** Queue capacity in records. */
+#define STORE_CAPACITY  ((STORESTOP_INIT - STORESTART_INIT + 1) / sizeof(struct store_sample))
+
+/** Index of oldest record. */
+static uint16_t _store_head;
+
+/** Number of records. */
+static uint16_t _store_count;
+
+/* Static function prototypes. */
+
+/**
+ * Get buffer memory address of record.
+ *
+ * @param index Record index.
+ */
+static inline uint16_t _store_address(uint16_t index);
+
+/* Implementation. */
+
+void store_init(void) {
+    _store_head = 0;
+    _store_count = 0;
+}
+
+bool store_push(struct store_sample *sample) {
+    uint16_t tail = _store_head + _store_count;
+    bool dropped = _store_count == STORE_CAPACITY;
+
+    if (tail >= STORE_CAPACITY)
+        tail -= STORE_CAPACITY;
+    enc28j60_mem_write(_store_address(tail), sizeof(*sample), (uint8_t *) sample);
+    if (dropped) {
+        /* Tail overwrote oldest record. */
+        if (++_store_head == STORE_CAPACITY)
+            _store_head = 0;
+    } else {
+        _store_count++;
+    }
+    return !dropped;
+}
+
+bool store_pop(struct store_sample *sample) {
+    if (_store_count == 0)
+        return false;
+    enc28j60_mem_read(_store_address(_store_head), sizeof(*sample), (uint8_t *) sample);
+    if (++_store_head == STORE_CAPACITY)
+        _store_head = 0;
+    _store_count--;
+    return true;
+}
+
+uint16_t store_count(void) {
+    return _store_count;
+}
+
+static inline uint16_t _store_address(uint16_t index) {
+    return STORESTART_INIT + index * sizeof(struct store_sample);
+}
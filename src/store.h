@@ -0,0 +1,72 @@
+/*
+ * Copyright (C) Ivo Slanina <ivo.slanina@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __STORE_H__
+#define __STORE_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "dht.h"
+#include "dhtstat.h"
+
+/*
+ * Store-and-forward queue of measurements taken while MQTT broker is not
+ * reachable. Records are kept in ENC28J60 buffer memory between
+ * STORESTART_INIT and STORESTOP_INIT, only queue indexes use AVR SRAM. When
+ * queue is full, oldest record is overwritten.
+ */
+
+/**
+ * Stored measurement.
+ */
+struct store_sample {
+    uint16_t timestamp;             /**< Time of measurement in seconds. */
+    uint8_t channel;                /**< Sensor index. */
+    enum dht_read_status status;    /**< Measurement status. */
+    struct dht_data data;           /**< Measured data. */
+#if MQTT_PUBLISH_STATS
+    struct dht_stats stats;         /**< Statistics of oversampling window. */
+#endif
+};
+
+/**
+ * Initiate empty queue.
+ */
+void store_init(void);
+
+/**
+ * Append measurement to queue.
+ *
+ * @param sample Measurement.
+ * @return False if oldest record was dropped to make space.
+ */
+bool store_push(struct store_sample *sample);
+
+/**
+ * Remove oldest measurement from queue.
+ *
+ * @param sample Output measurement.
+ * @return False if queue is empty.
+ */
+bool store_pop(struct store_sample *sample);
+
+/**
+ * @return Number of stored measurements.
+ */
+uint16_t store_count(void);
+
+#endif
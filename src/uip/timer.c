@@ -36,3 +36,11 @@ inline bool timer_tryrestart(struct timer *timer) {
 inline bool timer_expired(struct timer *timer) {
     return clock_time() - timer->start >= timer->interval;
 }
+
+clock_time_t timer_remaining(struct timer *timer) {
+    clock_time_t elapsed = clock_time() - timer->start;
+
+    if (elapsed >= timer->interval)
+        return 0;
+    return timer->interval - elapsed;
+}
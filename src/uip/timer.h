@@ -22,6 +22,9 @@
 #include <stdbool.h>
 #include "clock.h"
 
+/** Remaining time of timer which is not running. */
+#define TIMER_NEVER     ((clock_time_t) -1)
+
 /**
  * A timer.
  *
@@ -58,6 +61,13 @@ inline bool timer_tryrestart(struct timer *timer);
  */
 inline bool timer_expired(struct timer *timer);
 
+/**
+ * Get time until timer expires.
+ *
+ * @return Clock ticks until expiration, 0 if expired.
+ */
+clock_time_t timer_remaining(struct timer *timer);
+
 #endif /* __TIMER_H__ */
 
 /** @} */
@@ -290,6 +290,54 @@ void uip_add32(uint8_t *op32, uint16_t op16) {
 #endif /* UIP_ARCH_ADD32 */
 
 #if ! UIP_ARCH_CHKSUM
+#if defined(__AVR__)
+static uint16_t chksum(uint16_t sum, const uint8_t *data, uint16_t len) {
+    uint16_t words = len >> 1;
+    /* Inner loop runs count times first, then 256 times per remaining round. */
+    uint8_t count = words & 0xff;
+    uint8_t rounds = (words + 0xff) >> 8;
+    uint8_t high;
+    uint8_t low;
+    uint16_t t;
+
+    if (words > 0) {
+        /*
+         * Carry is chained from one word to the next through the whole loop,
+         * dec and brne leave it untouched. 9 cycles per word. Carry out of
+         * the last word is folded back, which can carry once more.
+         */
+        __asm__ volatile(
+            "clc"                           "\n\t"
+            "1:"                            "\n\t"
+            "ld   %[high], %a[data]+"       "\n\t"
+            "ld   %[low], %a[data]+"        "\n\t"
+            "adc  %A[sum], %[low]"          "\n\t"
+            "adc  %B[sum], %[high]"         "\n\t"
+            "dec  %[count]"                 "\n\t"
+            "brne 1b"                       "\n\t"
+            "dec  %[rounds]"                "\n\t"
+            "brne 1b"                       "\n\t"
+            "adc  %A[sum], __zero_reg__"    "\n\t"
+            "adc  %B[sum], __zero_reg__"    "\n\t"
+            "adc  %A[sum], __zero_reg__"    "\n\t"
+            : [sum] "+r" (sum), [data] "+e" (data), [count] "+r" (count),
+              [rounds] "+r" (rounds), [high] "=&r" (high), [low] "=&r" (low)
+            :
+            : "memory");
+    }
+
+    if (len & 1) {
+        t = data[0] << 8;
+        sum += t;
+        if (sum < t) {
+            sum++;      /* carry */
+        }
+    }
+
+    /* Return sum in host byte order. */
+    return sum;
+}
+#else
 static uint16_t chksum(uint16_t sum, const uint8_t *data, uint16_t len) {
     uint16_t t;
     const uint8_t *dataptr;
@@ -318,11 +366,64 @@ static uint16_t chksum(uint16_t sum, const uint8_t *data, uint16_t len) {
     /* Return sum in host byte order. */
     return sum;
 }
+#endif /* __AVR__ */
 
 uint16_t uip_chksum(uint16_t *data, uint16_t len) {
     return htons(chksum(0, (uint8_t *)data, len));
 }
 
+/**
+ * RFC 1071 reference: 32-bit accumulator, carries folded at the end.
+ */
+static uint16_t chksum_reference(uint16_t sum, const uint8_t *data, uint16_t len) {
+    uint32_t acc = sum;
+
+    for (; len > 1; len -= 2, data += 2)
+        acc += (data[0] << 8) | data[1];
+    if (len > 0)
+        acc += data[0] << 8;
+    while (acc >> 16)
+        acc = (acc & 0xffff) + (acc >> 16);
+    return acc;
+}
+
+uint16_t uip_chksum_selftest(void) {
+    /* Short lengths, then both sides of inner loop count wrapping to 256. */
+    static const uint16_t lengths[] = {
+        255, 256, 257, 510, 511, 512, 513, 514, 515, UIP_BUFSIZE - 1,
+    };
+    static const uint16_t sums[] = {0x0000, 0x0001, 0xfffe, 0xffff};
+    uint16_t errors = 0;
+    uint16_t seed = 1071;
+    uint16_t len;
+    uint16_t i;
+    uint8_t pattern;
+    uint8_t offset;
+    uint8_t s;
+
+    for (pattern = 0; pattern < 3; pattern++) {
+        /* Random bytes, all ones and ones with sparse zeros. Ones carry on every word. */
+        for (i = 0; i < UIP_BUFSIZE; i++) {
+            seed = seed * 25173 + 13849;
+            if (pattern == 0)
+                uip_buf[i] = seed >> 8;
+            else
+                uip_buf[i] = (pattern == 2 && i % 7 == 0) ? 0x00 : 0xff;
+        }
+        /* Odd offset moves words across 16-bit boundaries. */
+        for (offset = 0; offset < 2; offset++) {
+            for (i = 0; i < 64 + sizeof(lengths) / sizeof(lengths[0]); i++) {
+                len = i < 64 ? i : lengths[i - 64];
+                for (s = 0; s < sizeof(sums) / sizeof(sums[0]); s++) {
+                    if (chksum(sums[s], &uip_buf[offset], len) != chksum_reference(sums[s], &uip_buf[offset], len))
+                        errors++;
+                }
+            }
+        }
+    }
+    return errors;
+}
+
 #ifndef UIP_ARCH_IPCHKSUM
 uint16_t uip_ipchksum(void) {
     uint16_t sum;
@@ -359,7 +460,11 @@ uint16_t uip_icmp6chksum(void) {
 }
 #endif /* UIP_CONF_IPV6 */
 
+#if UIP_ARCH_TCPCHKSUM
+uint16_t uip_tcpchksum_soft(void) {
+#else
 uint16_t uip_tcpchksum(void) {
+#endif
     return upper_layer_chksum(UIP_PROTO_TCP);
 }
 
@@ -370,6 +475,10 @@ uint16_t uip_udpchksum(void) {
 #endif /* UIP_UDP_CHECKSUMS */
 #endif /* UIP_ARCH_CHKSUM */
 
+#if ! UIP_ARCH_TCPCHKSUM
+#define uip_tcpchksum_input() uip_tcpchksum()
+#endif
+
 void uip_init(void) {
     for (c = 0; c < UIP_LISTENPORTS; ++c)
         uip_listenports[c] = 0;
@@ -1108,7 +1217,7 @@ udp_send:
 tcp_input:
     UIP_STAT(++uip_stat.tcp.recv);
     /* Start of TCP input header processing code. */
-    if (uip_tcpchksum() != 0xffff) {
+    if (uip_tcpchksum_input() != 0xffff) {
         /* Compute and check the TCP checksum. */
         UIP_STAT(++uip_stat.tcp.drop);
         UIP_STAT(++uip_stat.tcp.chkerr);
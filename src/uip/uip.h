@@ -1560,6 +1560,15 @@ struct uip_eth_addr {
  */
 uint16_t uip_chksum(uint16_t *buf, uint16_t len);
 
+/**
+ * Check checksum routine against RFC 1071 reference on patterns written
+ * into uip_buf, which must not be in use. Covers odd and even lengths, odd
+ * alignment, nonzero initial sums and carry in every word.
+ *
+ * \return Number of mismatches, 0 when checksum routine is correct.
+ */
+uint16_t uip_chksum_selftest(void);
+
 /**
  * Calculate the IP header checksum of the packet header in uip_buf.
  *
@@ -1582,6 +1591,25 @@ uint16_t uip_ipchksum(void);
  */
 uint16_t uip_tcpchksum(void);
 
+#if UIP_ARCH_TCPCHKSUM
+/**
+ * Calculate the TCP checksum of the incoming segment in uip_buf.
+ *
+ * Provided by the architecture together with uip_tcpchksum(), which
+ * is then used for outgoing segments only.
+ *
+ * \return 0xffff if the checksum of the segment is valid.
+ */
+uint16_t uip_tcpchksum_input(void);
+
+/**
+ * Calculate the TCP checksum in software, see uip_tcpchksum().
+ *
+ * Available to the architecture providing TCP checksums.
+ */
+uint16_t uip_tcpchksum_soft(void);
+#endif
+
 /**
  * Calculate the UDP checksum of the packet in uip_buf and uip_appdata.
  *
@@ -53,7 +53,7 @@ typedef unsigned short uip_stats_t;
  *
  * \hideinitializer
  */
-#define UIP_CONF_BYTE_ORDER      LITTLE_ENDIAN
+#define UIP_CONF_BYTE_ORDER      UIP_LITTLE_ENDIAN
 
 /**
  * Logging on or off
@@ -106,6 +106,13 @@ typedef unsigned short uip_stats_t;
  */
 #define UIP_REASSEMBLY 0
 
+/**
+ * TCP checksums provided by network.c, which lets ENC28J60 compute them.
+ *
+ * \hideinitializer
+ */
+#define UIP_ARCH_TCPCHKSUM      ENC28J60_CSUM_OFFLOAD
+
 #endif
 
 /** @} */
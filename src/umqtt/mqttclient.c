@@ -15,14 +15,19 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
-#include <stdio.h>
 #include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <avr/pgmspace.h>
 #include "../config.h"
 #include "../uip/uip.h"
 #include "../uip/timer.h"
 #include "../dht.h"
+#include "../sampler.h"
 #include "../sharedbuf.h"
 #include "../actsig.h"
+#include "../store.h"
+#include "../common/fixfmt.h"
 #include "../config.h"
 #include "umqtt.h"
 #include "mqttclient.h"
@@ -30,62 +35,203 @@
 #define current_state           _mqttclient_state
 #define update_state(state)     (_mqttclient_state = state)
 
+/*
+ * MQTT packets waiting for transmission. Packets are not buffered, they are
+ * encoded directly into uip_appdata when uIP gives us a chance to send.
+ * Lower bit has higher priority.
+ */
+#define MQTTCLIENT_TX_CONNECT   _BV(0)
+#define MQTTCLIENT_TX_PRESENCE  _BV(1)
+#define MQTTCLIENT_TX_PING      _BV(2)
+#define MQTTCLIENT_TX_DATA      _BV(3)
+
+/** Measurement is published as single message on MQTT_TOPIC_DHT. */
+#define MQTTCLIENT_COMBINED     (MQTT_PAYLOAD_BINARY || MQTT_PAYLOAD_COMBINED)
+
+/** Published measurement topics. */
+#if MQTTCLIENT_COMBINED
+#define MQTTCLIENT_TOPIC_DHT            0
+#define MQTTCLIENT_TOPICS               1
+#else
+#define MQTTCLIENT_TOPIC_HUMIDITY       0
+#define MQTTCLIENT_TOPIC_TEMPERATURE    1
+#define MQTTCLIENT_TOPICS               2
+#endif
+
+/** Values published per measurement: median, or median, minimum, maximum and mean. */
+#if MQTT_PUBLISH_STATS
+#define MQTTCLIENT_VALUES               4
+#else
+#define MQTTCLIENT_VALUES               1
+#endif
+
+/** Size of measurement payload buffer. */
+#if MQTT_PAYLOAD_BINARY
+#define MQTTCLIENT_PAYLOAD_SIZE         (4 * MQTTCLIENT_VALUES + 3)
+#elif MQTT_PAYLOAD_COMBINED
+#define MQTTCLIENT_PAYLOAD_SIZE         (MQTTCLIENT_VALUES * (2 * FIXFMT_TENTHS_LEN + 2) + FIXFMT_UINT_LEN)
+#elif MQTT_PUBLISH_STATS
+#define MQTTCLIENT_PAYLOAD_SIZE         (MQTTCLIENT_VALUES * (FIXFMT_TENTHS_LEN + 1) + FIXFMT_UINT_LEN)
+#else
+#define MQTTCLIENT_PAYLOAD_SIZE         (sizeof("E_CHECKSUM") + FIXFMT_UINT_LEN)
+#endif
+
+/** Measurement was encoded into segment over current connection. */
+#define MQTTCLIENT_MEAS_SENT    _BV(0)
+/** Measurement was sent over previous connection. */
+#define MQTTCLIENT_MEAS_DUP     _BV(1)
+/** Measurement was taken offline, its age is published. */
+#define MQTTCLIENT_MEAS_STORED  _BV(2)
+
+/** Measurement waiting for acknowledgement. */
+struct mqttclient_measurement {
+    uint16_t message_id[MQTTCLIENT_TOPICS]; /**< QoS 1 message ids. */
+    uint8_t unacked;                        /**< Topics not acknowledged yet. */
+    uint8_t segment;                        /**< Topics in unacknowledged TCP segment. */
+    uint8_t flags;                          /**< MQTTCLIENT_MEAS_* flags. */
+    uint8_t channel;                        /**< Sensor index. */
+    uint16_t age;                           /**< Age in seconds when taken from store. */
+    enum dht_read_status status;
+    struct dht_data data;
+#if MQTT_PUBLISH_STATS
+    struct dht_stats stats;
+#endif
+};
+
 /** Current MQTT client state. */
 static enum mqttclient_state _mqttclient_state;
 
 /** Timer for ending MQTT Keep Alive messages. */
 static struct timer _keep_alive_timer;
 
-/** Timer for sending DHT measurements. */
-static struct timer _dht_timer;
-
 /** Timer for limit reconnect attempts. */
 static struct timer _disconnected_wait_timer;
 
-/** Send data buffer. */
-static uint8_t *_mqttclient_send_buffer = sharedbuf.mqtt.send_buffer;
-
-/** Send data length. */
-static uint16_t _mqttclient_send_length;
-
 /** Signaling network activity. */
 static struct actsig_signal _broker_signal;
 
-/** Keep track if some send is in progress. */
-static bool _is_sending = false;
+/** Packets waiting for transmission. */
+static uint8_t _tx_pending;
+
+/** Packets sent in segment which is not acknowledged yet. */
+static uint8_t _tx_inflight;
+
+/**
+ * Measurements being published. Slot is kept until all its topics are
+ * acknowledged, by PUBACK for QoS 1 or by TCP ACK for QoS 0. While window is
+ * full, new measurements are stored.
+ */
+static struct mqttclient_measurement _window[MQTT_PUBLISH_WINDOW];
+
+#if MQTT_PUBLISH_HEARTBEAT
+/** Last measurement of each sensor passed to publishing, reference for deadband and heartbeat. */
+static struct store_sample _reported[DHT_SENSORS];
+
+/** Some measurement of sensor was already passed to publishing. */
+static bool _reported_valid[DHT_SENSORS];
+#endif
 
-/** Connection configuration. */
-static struct umqtt_connect_config _connection_config = {
+/*
+ * Sensor 0 publishes on configured topics, sensor n on configured topics with
+ * "/n" suffix. Aliases above UMQTT_TOPIC_ALIAS_MAX are not used.
+ */
+#if MQTTCLIENT_COMBINED
+#define MQTTCLIENT_CHANNEL_TOPICS(n, suffix) \
+    static const struct umqtt_topic _topic_dht_##n PROGMEM = UMQTT_TOPIC_INIT(MQTT_TOPIC_DHT suffix, (n) + 1)
+#define MQTTCLIENT_CHANNEL_TABLE(n) \
+    { &_topic_dht_##n }
+#else
+#define MQTTCLIENT_CHANNEL_TOPICS(n, suffix) \
+    static const struct umqtt_topic _topic_humidity_##n PROGMEM = UMQTT_TOPIC_INIT(MQTT_TOPIC_HUMIDITY suffix, 2 * (n) + 1); \
+    static const struct umqtt_topic _topic_temperature_##n PROGMEM = UMQTT_TOPIC_INIT(MQTT_TOPIC_TEMPERATURE suffix, 2 * (n) + 2)
+#define MQTTCLIENT_CHANNEL_TABLE(n) \
+    { &_topic_humidity_##n, &_topic_temperature_##n }
+#endif
+
+MQTTCLIENT_CHANNEL_TOPICS(0, "");
+#if DHT_SENSORS > 1
+MQTTCLIENT_CHANNEL_TOPICS(1, "/1");
+#endif
+#if DHT_SENSORS > 2
+MQTTCLIENT_CHANNEL_TOPICS(2, "/2");
+#endif
+#if DHT_SENSORS > 3
+MQTTCLIENT_CHANNEL_TOPICS(3, "/3");
+#endif
+#if DHT_SENSORS > 4
+MQTTCLIENT_CHANNEL_TOPICS(4, "/4");
+#endif
+#if DHT_SENSORS > 5
+MQTTCLIENT_CHANNEL_TOPICS(5, "/5");
+#endif
+
+/** Topics in program memory indexed by sensor and MQTTCLIENT_TOPIC_*. */
+static const struct umqtt_topic *const _topics[DHT_SENSORS][MQTTCLIENT_TOPICS] PROGMEM = {
+    MQTTCLIENT_CHANNEL_TABLE(0),
+#if DHT_SENSORS > 1
+    MQTTCLIENT_CHANNEL_TABLE(1),
+#endif
+#if DHT_SENSORS > 2
+    MQTTCLIENT_CHANNEL_TABLE(2),
+#endif
+#if DHT_SENSORS > 3
+    MQTTCLIENT_CHANNEL_TABLE(3),
+#endif
+#if DHT_SENSORS > 4
+    MQTTCLIENT_CHANNEL_TABLE(4),
+#endif
+#if DHT_SENSORS > 5
+    MQTTCLIENT_CHANNEL_TABLE(5),
+#endif
+};
+
+static const char _client_id[] PROGMEM = MQTT_CLIENT_ID;
+static const char _presence_topic[] PROGMEM = MQTT_NODE_PRESENCE_TOPIC;
+static const char _presence_online[] PROGMEM = MQTT_NODE_PRESENCE_MSG_ONLINE;
+static const char _presence_offline[] PROGMEM = MQTT_NODE_PRESENCE_MSG_OFFLINE;
+
+/** Connection configuration, all of it in program memory. */
+static const struct umqtt_connect_config _connection_config PROGMEM = {
     .keep_alive = MQTT_KEEP_ALIVE,
-    .client_id = MQTT_CLIENT_ID,
-    .will_topic = MQTT_NODE_PRESENCE_TOPIC,
-    .will_message = (uint8_t *) MQTT_NODE_PRESENCE_MSG_OFFLINE,
-    .will_message_len = sizeof(MQTT_NODE_PRESENCE_MSG_OFFLINE),
+    .client_id = (char *) _client_id,
+    .will_topic = (char *) _presence_topic,
+    .will_message = (uint8_t *) _presence_offline,
+    .will_message_len = sizeof(_presence_offline),
+#if MQTT_PUBLISH_QOS
+    /* Unacknowledged measurements are resent with DUP within the same session. */
+    .flags = _BV(UMQTT_OPT_RETAIN) | _BV(UMQTT_OPT_PERSISTENT),
+#else
     .flags = _BV(UMQTT_OPT_RETAIN),
+#endif
 };
 
 /**
  * Handle incomming message.
  *
  * @param conn MQTT connection.
- * @param topic Topic name.
- * @param data Topic payload.
- * @param len Payload length.
+ * @param part Part of message.
+ * @param data Chunk of topic name or payload.
+ * @param len Chunk length.
+ */
+static void _mqttclient_handle_message(struct umqtt_connection *conn, enum umqtt_message_part part, uint8_t *data, uint16_t len);
+
+/**
+ * Handle acknowledged QoS 1 publish.
+ *
+ * @param conn MQTT connection.
+ * @param message_id Id of acknowledged message.
  */
-static void _mqttclient_handle_message(struct umqtt_connection *conn, char *topic, uint8_t *data, uint16_t len);
+static void _mqttclient_handle_puback(struct umqtt_connection *conn, uint16_t message_id);
 
 
 /** MQTT connection structure instance. */
 static struct umqtt_connection _mqtt = {
-    .txbuff = {
-        .start = sharedbuf.mqtt.mqtt_tx,
-        .length = SHAREDBUF_NODE_UMQTT_TX_SIZE,
-    },
     .rxbuff = {
         .start = sharedbuf.mqtt.mqtt_rx,
         .length = SHAREDBUF_NODE_UMQTT_RX_SIZE,
     },
     .message_callback = _mqttclient_handle_message,
+    .puback_callback = _mqttclient_handle_puback,
     .state = UMQTT_STATE_INIT,
 };
 
@@ -107,9 +253,116 @@ static void _mqttclient_broker_connect(void);
 static void _mqttclient_handle_disconnected_wait(void);
 
 /**
- * Send data.
+ * Take measurements from sampler. Measurements which can't be published right
+ * away are stored for later publishing.
+ */
+static void _mqttclient_process_samples(void);
+
+#if MQTT_PUBLISH_HEARTBEAT
+/**
+ * Report by exception. Measurement is reported when its status differs from
+ * last reported one, a value moves beyond its deadband or heartbeat expires.
+ *
+ * @param sample Measurement.
+ * @return True if measurement should be published.
+ */
+static bool _mqttclient_is_reportable(struct store_sample *sample);
+#endif
+
+/**
+ * Put measurement into publish window.
+ *
+ * @param sample Measurement.
+ * @param stored True if measurement comes from store.
+ */
+static void _mqttclient_publish_sample(struct store_sample *sample, bool stored);
+
+/**
+ * Encode measurement publish packets. Regular transmission takes measurements
+ * not sent yet, retransmission repeats measurements of unacknowledged segment.
+ *
+ * @return True if at least one measurement fits into TX buffer.
+ */
+static bool _mqttclient_send_data(void);
+
+/**
+ * Encode publish packets of one measurement.
+ *
+ * @param m Measurement.
+ * @param topics Bits of MQTTCLIENT_TOPIC_* topics to publish.
+ * @return True if all packets fit into TX buffer.
+ */
+static bool _mqttclient_send_measurement(struct mqttclient_measurement *m, uint8_t topics);
+
+/**
+ * Format measurement payload.
+ *
+ * @param m Measurement.
+ * @param topic MQTTCLIENT_TOPIC_* topic.
+ * @param buffer Output buffer of MQTTCLIENT_PAYLOAD_SIZE bytes.
+ * @return Payload length.
+ */
+static uint8_t _mqttclient_format(struct mqttclient_measurement *m, uint8_t topic, uint8_t *buffer);
+
+#if MQTT_PAYLOAD_BINARY
+/**
+ * Encode measured data as big endian temperature and humidity.
+ *
+ * @param data Measured data.
+ * @param buffer Output buffer of 4 bytes.
+ */
+static void _mqttclient_format_data(struct dht_data *data, uint8_t *buffer);
+#else
+/**
+ * Format measured data of topic as text.
+ *
+ * @param data Measured data.
+ * @param topic MQTTCLIENT_TOPIC_* topic.
+ * @param buffer Output buffer.
+ * @return Output length.
+ */
+static uint8_t _mqttclient_format_data(struct dht_data *data, uint8_t topic, char *buffer);
+
+/**
+ * Format measured value or error code as text.
+ *
+ * @param m Measurement.
+ * @param topic MQTTCLIENT_TOPIC_* topic.
+ * @param buffer Output buffer.
+ * @return Payload length.
+ */
+static uint8_t _mqttclient_format_value(struct mqttclient_measurement *m, uint8_t topic, char *buffer);
+#endif
+
+/**
+ * Find free slot in measurement window.
+ *
+ * @return Free slot or NULL if window is full.
+ */
+static struct mqttclient_measurement *_mqttclient_window_slot(void);
+
+/**
+ * Request DATA transmission if MQTT connection is established and some
+ * measurement was not sent yet.
  */
-static void _mqttclient_send_data(void);
+static void _mqttclient_request_data(void);
+
+/**
+ * Update measurement window after segment was acknowledged by TCP.
+ */
+static void _mqttclient_segment_acked(void);
+
+/**
+ * Update measurement window after connection was lost. Measurements will be
+ * sent again with DUP flag.
+ */
+static void _mqttclient_window_disconnected(void);
+
+/**
+ * Update measurement window after broker started new session. It knows none
+ * of measurements sent before, they are sent again as new messages.
+ */
+static void _mqttclient_window_new_session(void);
 
 /**
  * Initiate MQTT client.
@@ -120,8 +373,9 @@ static void _mqttclient_mqtt_init(void);
  * Send keep alive message.
  *
  * @param conn MQTT connection.
+ * @return True if packet fits into TX buffer.
  */
-static void _mqttclient_umqtt_keep_alive(struct umqtt_connection *conn);
+static bool _mqttclient_umqtt_keep_alive(struct umqtt_connection *conn);
 
 /**
  * Handle new arrived data.
@@ -139,9 +393,50 @@ static inline void _mqttclient_handle_communication_error(void);
 static inline void _mqttclient_send(void);
 
 /**
- * Pop uMQTT circ buffer and transfer it over network.
+ * Queue packet for transmission.
+ *
+ * @param packet MQTTCLIENT_TX_* packet flag.
  */
-static void _mqttclient_transfer_buffer(void);
+static inline void _mqttclient_request(uint8_t packet);
+
+/**
+ * Check if packet is waiting for transmission or acknowledgement.
+ *
+ * @param packet MQTTCLIENT_TX_* packet flag.
+ */
+static inline bool _mqttclient_is_queued(uint8_t packet);
+
+/**
+ * Encode all pending packets which fit into one segment and send them, if
+ * there is no unacknowledged data.
+ */
+static void _mqttclient_transmit(void);
+
+/**
+ * Encode unacknowledged packets again.
+ */
+static void _mqttclient_retransmit(void);
+
+/**
+ * Point uMQTT TX buffer to uIP application data buffer.
+ */
+static void _mqttclient_tx_bind(void);
+
+/**
+ * Encode packets into TX buffer in priority order.
+ *
+ * @param packets MQTTCLIENT_TX_* packet flags.
+ * @return Flags of packets which were encoded.
+ */
+static uint8_t _mqttclient_encode(uint8_t packets);
+
+/**
+ * Encode single packet into TX buffer. Partially encoded packet is dropped.
+ *
+ * @param packet MQTTCLIENT_TX_* packet flag.
+ * @return True if packet fits into TX buffer.
+ */
+static bool _mqttclient_encode_packet(uint8_t packet);
 
 /**
  * Signal established TCP connection with MQTT broker.
@@ -157,8 +452,8 @@ static inline void _mqttclient_signal_disconnected(void);
 
 void mqttclient_init(void) {
     _mqttclient_mqtt_init();
+    store_init();
     timer_set(&_keep_alive_timer, CLOCK_SECOND * MQTT_KEEP_ALIVE / 2);
-    timer_set(&_dht_timer, CLOCK_SECOND * MQTT_PUBLISH_PERIOD);
     timer_set(&_disconnected_wait_timer, CLOCK_SECOND);
     actsig_init(&_broker_signal,
                 CONFIG_SIGNAL_LED_PIN,
@@ -170,6 +465,7 @@ void mqttclient_init(void) {
 
 void mqttclient_process(void) {
     actsig_process(&_broker_signal);
+    _mqttclient_process_samples();
     switch (current_state) {
         case MQTTCLIENT_BROKER_CONNECTION_ESTABLISHED:
             _mqttclient_process_connected();
@@ -186,27 +482,65 @@ void mqttclient_process(void) {
 }
 
 void mqttclient_appcall(void) {
-    if (uip_poll()) {
-        _mqttclient_transfer_buffer();
-    } else if (uip_connected()) {
+    if (uip_connected()) {
         update_state(MQTTCLIENT_BROKER_CONNECTION_ESTABLISHED);
-        umqtt_connect(&_mqtt, &_connection_config);
-        _mqttclient_transfer_buffer();
+        /* Drop partial packet left from previous connection. */
+        _mqttclient_mqtt_init();
+        _tx_pending = MQTTCLIENT_TX_CONNECT;
+        _tx_inflight = 0;
+        _mqttclient_transmit();
     } else if (uip_aborted() || uip_timedout() || uip_closed()) {
         _mqttclient_handle_communication_error();
-    } else  if (uip_newdata()) {
-        _mqttclient_handle_new_data();
-    } else if (uip_acked()) {
-        _is_sending = false;
     } else if (uip_rexmit()) {
-        _mqttclient_send();
+        _mqttclient_retransmit();
+    } else {
+        if (uip_acked()) {
+            _tx_inflight = 0;
+            umqtt_tx_acked(&_mqtt);
+            _mqttclient_segment_acked();
+        }
+        if (uip_newdata())
+            _mqttclient_handle_new_data();
+        _mqttclient_transmit();
+    }
+}
+
+clock_time_t mqttclient_remaining(void) {
+    clock_time_t remaining = actsig_remaining(&_broker_signal);
+    clock_time_t next = TIMER_NEVER;
+
+    switch (current_state) {
+        case MQTTCLIENT_BROKER_CONNECTION_ESTABLISHED:
+            /* Queued ping waits for uIP poll. */
+            if (_mqtt.state == UMQTT_STATE_CONNECTED && !_mqttclient_is_queued(MQTTCLIENT_TX_PING))
+                next = timer_remaining(&_keep_alive_timer);
+            break;
+        case MQTTCLIENT_BROKER_DISCONNECTED:
+            /* Connection is opened as soon as uIP has free slot. */
+            return 0;
+        case MQTTCLIENT_BROKER_DISCONNECTED_WAIT:
+            next = timer_remaining(&_disconnected_wait_timer);
+            break;
+        default:
+            break;
     }
+    return next < remaining ? next : remaining;
 }
 
 static inline void _mqttclient_handle_new_data(void) {
     enum umqtt_client_state previous_state = _mqtt.state;
-    umqtt_circ_push(&uip_conn->appstate.conn->rxbuff, uip_appdata, uip_datalen());
-    umqtt_process(uip_conn->appstate.conn);
+    struct umqtt_connection *conn = uip_conn->appstate.conn;
+    uint8_t *data = uip_appdata;
+    int16_t len = uip_datalen();
+    int16_t left;
+
+    /* Segment may be larger than RX buffer, parser drains it after each push. */
+    while (len > 0) {
+        left = umqtt_circ_push(&conn->rxbuff, data, len);
+        data += len - left;
+        len = left;
+        umqtt_process(conn);
+    }
 
     /* Check for connection event. */
     if (previous_state != UMQTT_STATE_CONNECTED && _mqtt.state == UMQTT_STATE_CONNECTED) {
@@ -214,25 +548,102 @@ static inline void _mqttclient_handle_new_data(void) {
         /* Signal established connection. */
         _mqttclient_signal_connected();
 
-        /* Send presence message. */
-        umqtt_publish(&_mqtt,
-                        MQTT_NODE_PRESENCE_TOPIC,
-                        (uint8_t *) MQTT_NODE_PRESENCE_MSG_ONLINE,
-                        sizeof(MQTT_NODE_PRESENCE_MSG_ONLINE),
-                        _BV(UMQTT_OPT_RETAIN));
+        if (!_mqtt.session_present)
+            _mqttclient_window_new_session();
+
+        /* Send presence message and measurements left from previous connection. */
+        _mqttclient_request(MQTTCLIENT_TX_PRESENCE);
+        _mqttclient_request_data();
     }
 }
 
-static void _mqttclient_transfer_buffer(void) {
-    _mqttclient_send_length = umqtt_circ_pop(&uip_conn->appstate.conn->txbuff,
-                                                _mqttclient_send_buffer,
-                                                sizeof(sharedbuf.mqtt.send_buffer));
-    if (_mqttclient_send_length) {
-        _is_sending = true;
+static void _mqttclient_transmit(void) {
+    if (_tx_inflight || !_tx_pending)
+        return;
+    _mqttclient_tx_bind();
+    /* Coalesce everything that fits into single segment. */
+    _tx_inflight = _mqttclient_encode(_tx_pending);
+    _tx_pending &= ~_tx_inflight;
+    /* Measurements which did not fit wait for next segment. */
+    _mqttclient_request_data();
+    if (_tx_inflight) {
+        /* Any packet sent to broker resets keep alive interval. */
+        timer_restart(&_keep_alive_timer);
         _mqttclient_send();
     }
 }
 
+static void _mqttclient_retransmit(void) {
+    struct umqtt_tx_mark mark;
+
+    _mqttclient_tx_bind();
+    umqtt_tx_mark(&_mqtt, &mark);
+    _mqttclient_encode(_tx_inflight);
+    /* Packets were counted when the segment was sent first. */
+    umqtt_tx_repeated(&_mqtt, &mark);
+    _mqttclient_send();
+}
+
+static void _mqttclient_tx_bind(void) {
+    uint16_t len = uip_mss();
+#if UMQTT_CIRC_POW2
+    /* Round down to power of two by clearing lowest set bits. */
+    while (len & (len - 1))
+        len &= len - 1;
+#endif
+    _mqtt.txbuff.start = uip_appdata;
+    _mqtt.txbuff.length = len;
+    umqtt_circ_init(&_mqtt.txbuff);
+}
+
+static uint8_t _mqttclient_encode(uint8_t packets) {
+    uint8_t encoded = 0;
+    uint8_t packet;
+
+    for (packet = MQTTCLIENT_TX_CONNECT; packet <= MQTTCLIENT_TX_DATA; packet <<= 1) {
+        if ((packets & packet) && _mqttclient_encode_packet(packet))
+            encoded |= packet;
+    }
+    return encoded;
+}
+
+static bool _mqttclient_encode_packet(uint8_t packet) {
+    struct umqtt_tx_mark mark;
+    bool fits = false;
+
+    umqtt_tx_mark(&_mqtt, &mark);
+
+    switch (packet) {
+        case MQTTCLIENT_TX_CONNECT:
+            fits = umqtt_connect_P(&_mqtt, &_connection_config);
+            break;
+        case MQTTCLIENT_TX_PRESENCE:
+            fits = umqtt_publish_P(&_mqtt,
+                                   _presence_topic,
+                                   (const uint8_t *) _presence_online,
+                                   sizeof(_presence_online),
+                                   _BV(UMQTT_OPT_RETAIN));
+            break;
+        case MQTTCLIENT_TX_PING:
+            fits = _mqttclient_umqtt_keep_alive(&_mqtt);
+            break;
+        case MQTTCLIENT_TX_DATA:
+            fits = _mqttclient_send_data();
+            break;
+    }
+    if (!fits)
+        umqtt_tx_rollback(&_mqtt, &mark);
+    return fits;
+}
+
+static inline void _mqttclient_request(uint8_t packet) {
+    _tx_pending |= packet;
+}
+
+static inline bool _mqttclient_is_queued(uint8_t packet) {
+    return (_tx_pending | _tx_inflight) & packet;
+}
+
 static inline void _mqttclient_handle_communication_error(void) {
     _mqttclient_signal_disconnected();
     if (current_state == MQTTCLIENT_BROKER_CONNECTING) {
@@ -244,20 +655,16 @@ static inline void _mqttclient_handle_communication_error(void) {
         update_state(MQTTCLIENT_BROKER_DISCONNECTED);
         _mqtt.state = UMQTT_STATE_INIT;
     }
+    _tx_pending = 0;
+    _tx_inflight = 0;
+    _mqttclient_window_disconnected();
 }
 
 static inline void _mqttclient_process_connected(void) {
-    if (!_is_sending) {
-        if (_mqtt.state == UMQTT_STATE_CONNECTED) {
-            if (timer_tryrestart(&_keep_alive_timer)) {
-                _mqttclient_umqtt_keep_alive(&_mqtt);
-                return;
-            }
-            if (timer_tryrestart(&_dht_timer)) {
-                _mqttclient_send_data();
-                return;
-            }
-        }
+    if (_mqtt.state == UMQTT_STATE_CONNECTED) {
+        /* Requests are not sent immediately, packets due together share segment. */
+        if (!_mqttclient_is_queued(MQTTCLIENT_TX_PING) && timer_tryrestart(&_keep_alive_timer))
+            _mqttclient_request(MQTTCLIENT_TX_PING);
     }
 }
 
@@ -283,65 +690,313 @@ static void _mqttclient_handle_disconnected_wait(void) {
         _mqttclient_broker_connect();
 }
 
-static void _mqttclient_send_data(void) {
-    enum dht_read_status status = dht_read();
-    // TODO: remove hardcoded constant
-    char buffer[20];
-    uint8_t len = 0;
-    int16_t _val_integral;
-    uint16_t _val_decimal;
-    switch (status) {
+static void _mqttclient_process_samples(void) {
+    struct store_sample sample;
+    bool online = current_state == MQTTCLIENT_BROKER_CONNECTION_ESTABLISHED &&
+            _mqtt.state == UMQTT_STATE_CONNECTED;
+
+    if (online) {
+        /* Drain stored measurements first, window keeps them in order. */
+        while (store_count() > 0 && _mqttclient_window_slot() != NULL) {
+            store_pop(&sample);
+            _mqttclient_publish_sample(&sample, true);
+        }
+    }
+    while (sampler_pop(&sample)) {
+#if MQTT_PUBLISH_HEARTBEAT
+        if (!_mqttclient_is_reportable(&sample))
+            continue;
+#endif
+        /* Measurement waits in store behind older ones or for free window slot. */
+        if (online && store_count() == 0 && _mqttclient_window_slot() != NULL)
+            _mqttclient_publish_sample(&sample, false);
+        else
+            store_push(&sample);
+    }
+}
+
+#if MQTT_PUBLISH_HEARTBEAT
+static bool _mqttclient_is_reportable(struct store_sample *sample) {
+    struct store_sample *reported = &_reported[sample->channel];
+
+    if (_reported_valid[sample->channel] && sample->status == reported->status &&
+            (uint16_t) (sample->timestamp - reported->timestamp) < MQTT_PUBLISH_HEARTBEAT) {
+        /* Error codes have no value to compare. */
+        if (sample->status != DHT_OK)
+            return false;
+        if (abs(sample->data.temperature - reported->data.temperature) <= MQTT_PUBLISH_DEADBAND_TEMPERATURE &&
+                abs((int16_t) (sample->data.humidity - reported->data.humidity)) <= MQTT_PUBLISH_DEADBAND_HUMIDITY)
+            return false;
+    }
+    *reported = *sample;
+    _reported_valid[sample->channel] = true;
+    return true;
+}
+#endif
+
+static void _mqttclient_publish_sample(struct store_sample *sample, bool stored) {
+    struct mqttclient_measurement *m = _mqttclient_window_slot();
+#if MQTT_PUBLISH_QOS
+    uint8_t topic;
+#endif
+
+    m->channel = sample->channel;
+    m->status = sample->status;
+    m->data = sample->data;
+#if MQTT_PUBLISH_STATS
+    m->stats = sample->stats;
+#endif
+    m->flags = stored ? MQTTCLIENT_MEAS_STORED : 0;
+    /* Age is fixed now, retransmission has to encode the same payload. */
+    m->age = (uint16_t) clock_time_seconds() - sample->timestamp;
+    m->unacked = _BV(MQTTCLIENT_TOPICS) - 1;
+#if MQTT_PUBLISH_QOS
+    for (topic = 0; topic < MQTTCLIENT_TOPICS; topic++)
+        m->message_id[topic] = umqtt_message_id(&_mqtt);
+#endif
+    _mqttclient_request(MQTTCLIENT_TX_DATA);
+}
+
+static bool _mqttclient_send_data(void) {
+    /* DATA is in flight only while encoding retransmission. */
+    bool retransmit = _tx_inflight & MQTTCLIENT_TX_DATA;
+    bool encoded = false;
+    struct mqttclient_measurement *m;
+    struct umqtt_tx_mark mark;
+    uint8_t topics;
+
+    for (m = _window; m < _window + MQTT_PUBLISH_WINDOW; m++) {
+        if (retransmit)
+            topics = m->segment;
+        else if (!(m->flags & MQTTCLIENT_MEAS_SENT))
+            topics = m->unacked;
+        else
+            topics = 0;
+        if (!topics)
+            continue;
+        umqtt_tx_mark(&_mqtt, &mark);
+        if (!_mqttclient_send_measurement(m, topics)) {
+            /* Drop partially encoded measurement. */
+            umqtt_tx_rollback(&_mqtt, &mark);
+            break;
+        }
+        m->segment = topics;
+        m->flags |= MQTTCLIENT_MEAS_SENT;
+        encoded = true;
+    }
+    return encoded;
+}
+
+static bool _mqttclient_send_measurement(struct mqttclient_measurement *m, uint8_t topics) {
+    uint8_t buffer[MQTTCLIENT_PAYLOAD_SIZE];
+    uint8_t len;
+    uint8_t topic;
+
+    for (topic = 0; topic < MQTTCLIENT_TOPICS; topic++) {
+        if (!(topics & _BV(topic)))
+            continue;
+        len = _mqttclient_format(m, topic, buffer);
+#if MQTT_PUBLISH_QOS
+        if (!umqtt_publish_topic(&_mqtt, pgm_read_ptr(&_topics[m->channel][topic]), buffer, len,
+                                 m->flags & MQTTCLIENT_MEAS_DUP ? _BV(UMQTT_OPT_DUP) : 0,
+                                 m->message_id[topic]))
+            return false;
+#else
+        if (!umqtt_publish_topic(&_mqtt, pgm_read_ptr(&_topics[m->channel][topic]), buffer, len, 0, 0))
+            return false;
+#endif
+    }
+    return true;
+}
+
+static uint8_t _mqttclient_format(struct mqttclient_measurement *m, uint8_t topic, uint8_t *buffer) {
+#if MQTT_PAYLOAD_BINARY
+    uint8_t len = 5;
+#if MQTT_PUBLISH_STATS
+    struct dht_data *stat;
+#endif
+
+    /* Big endian record, data are valid only with DHT_OK status. */
+    _mqttclient_format_data(&m->data, buffer);
+    buffer[4] = m->status;
+#if MQTT_PUBLISH_STATS
+    /* Minimum, maximum and mean follow status. */
+    for (stat = &m->stats.min; stat <= &m->stats.mean; stat++) {
+        _mqttclient_format_data(stat, buffer + len);
+        len += 4;
+    }
+#endif
+    if (!(m->flags & MQTTCLIENT_MEAS_STORED))
+        return len;
+    /* Measurement taken offline carries its age. */
+    buffer[len++] = m->age >> 8;
+    buffer[len++] = m->age & 0xff;
+    return len;
+#else
+    char *p = (char *) buffer;
+
+    p += _mqttclient_format_value(m, topic, p);
+    /* Measurement taken offline carries its age. */
+    if (m->flags & MQTTCLIENT_MEAS_STORED) {
+        *p++ = ';';
+        p += fixfmt_uint(p, m->age);
+    }
+    return p - (char *) buffer;
+#endif
+}
+
+#if MQTT_PAYLOAD_BINARY
+static void _mqttclient_format_data(struct dht_data *data, uint8_t *buffer) {
+    buffer[0] = data->temperature >> 8;
+    buffer[1] = data->temperature & 0xff;
+    buffer[2] = data->humidity >> 8;
+    buffer[3] = data->humidity & 0xff;
+}
+#else
+static uint8_t _mqttclient_format_data(struct dht_data *data, uint8_t topic, char *buffer) {
+#if MQTT_PAYLOAD_COMBINED
+    uint8_t len;
+
+    /* Temperature and humidity separated by comma. */
+    len = fixfmt_tenths(buffer, data->temperature);
+    buffer[len++] = ',';
+    return len + fixfmt_tenths(buffer + len, data->humidity);
+#else
+    if (topic == MQTTCLIENT_TOPIC_HUMIDITY)
+        return fixfmt_tenths(buffer, data->humidity);
+    return fixfmt_tenths(buffer, data->temperature);
+#endif
+}
+
+static uint8_t _mqttclient_format_value(struct mqttclient_measurement *m, uint8_t topic, char *buffer) {
+    PGM_P error;
+    uint8_t len;
+#if MQTT_PUBLISH_STATS
+    struct dht_data *stat;
+#endif
+
+    switch (m->status) {
         case DHT_OK:
-            /* If status is OK, publish measured data and return from function. */
-            _val_integral = dht_data.humidity / 10;
-            _val_decimal = dht_data.humidity % 10;
-            len = snprintf(buffer, sizeof(buffer), "%d.%u", _val_integral, _val_decimal);
-            umqtt_publish(&_mqtt, MQTT_TOPIC_HUMIDITY, (uint8_t *)buffer, len, 0);
-            if (dht_data.temperature < 0) {
-                _val_integral = dht_data.temperature / 10;
-                _val_decimal = -dht_data.temperature % 10;
-            } else {
-                _val_integral = dht_data.temperature / 10;
-                _val_decimal = dht_data.temperature % 10;
+            len = _mqttclient_format_data(&m->data, topic, buffer);
+#if MQTT_PUBLISH_STATS
+            /* Minimum, maximum and mean follow median. */
+            for (stat = &m->stats.min; stat <= &m->stats.mean; stat++) {
+                buffer[len++] = ';';
+                len += _mqttclient_format_data(stat, topic, buffer + len);
             }
-            len = snprintf(buffer, sizeof(buffer), "%d.%u", _val_integral, _val_decimal);
-            umqtt_publish(&_mqtt, MQTT_TOPIC_TEMPERATURE, (uint8_t *)buffer, len, 0);
-            return;
+#endif
+            return len;
         case DHT_ERROR_CHECKSUM:
-            len = snprintf(buffer, sizeof(buffer), "E_CHECKSUM");
+            error = PSTR("E_CHECKSUM");
             break;
         case DHT_ERROR_TIMEOUT:
-            len = snprintf(buffer, sizeof(buffer), "E_TIMEOUT");
+            error = PSTR("E_TIMEOUT");
             break;
         case DHT_ERROR_CONNECT:
-            len = snprintf(buffer, sizeof(buffer), "E_CONNECT");
+            error = PSTR("E_CONNECT");
             break;
         case DHT_ERROR_ACK:
-            len = snprintf(buffer, sizeof(buffer), "E_ACK");
+            error = PSTR("E_ACK");
             break;
+        default:
+            return 0;
     }
+    /* Error codes are published to all topics. */
+    len = strlen_P(error);
+    memcpy_P(buffer, error, len);
+    return len;
+}
+#endif
+
+static struct mqttclient_measurement *_mqttclient_window_slot(void) {
+    struct mqttclient_measurement *m;
 
-    /* Publish error codes. */
-    umqtt_publish(&_mqtt, MQTT_TOPIC_HUMIDITY, (uint8_t *)buffer, len, 0);
-    umqtt_publish(&_mqtt, MQTT_TOPIC_TEMPERATURE, (uint8_t *)buffer, len, 0);
+    /* Slot in unacknowledged segment can't be reused, it may be retransmitted. */
+    for (m = _window; m < _window + MQTT_PUBLISH_WINDOW; m++) {
+        if (!m->unacked && !m->segment)
+            return m;
+    }
+    return NULL;
+}
+
+static void _mqttclient_request_data(void) {
+    struct mqttclient_measurement *m;
+
+    /* Measurements from previous connection wait for CONNACK. */
+    if (_mqtt.state != UMQTT_STATE_CONNECTED)
+        return;
+    for (m = _window; m < _window + MQTT_PUBLISH_WINDOW; m++) {
+        if (m->unacked && !(m->flags & MQTTCLIENT_MEAS_SENT)) {
+            _mqttclient_request(MQTTCLIENT_TX_DATA);
+            return;
+        }
+    }
+}
+
+static void _mqttclient_segment_acked(void) {
+    struct mqttclient_measurement *m;
+
+    for (m = _window; m < _window + MQTT_PUBLISH_WINDOW; m++) {
+#if !MQTT_PUBLISH_QOS
+        /* QoS 0 is done once TCP delivers it. */
+        m->unacked &= ~m->segment;
+#endif
+        m->segment = 0;
+    }
+}
+
+static void _mqttclient_window_disconnected(void) {
+    struct mqttclient_measurement *m;
+
+    for (m = _window; m < _window + MQTT_PUBLISH_WINDOW; m++) {
+        if (m->flags & MQTTCLIENT_MEAS_SENT)
+            m->flags = (m->flags & ~MQTTCLIENT_MEAS_SENT) | MQTTCLIENT_MEAS_DUP;
+        m->segment = 0;
+    }
+}
+
+static void _mqttclient_window_new_session(void) {
+    struct mqttclient_measurement *m;
+
+    for (m = _window; m < _window + MQTT_PUBLISH_WINDOW; m++)
+        m->flags &= ~MQTTCLIENT_MEAS_DUP;
 }
 
 static void _mqttclient_mqtt_init(void) {
+    uint16_t message_id = _mqtt.message_id;
+
     umqtt_init(&_mqtt);
-    umqtt_circ_init(&_mqtt.txbuff);
     umqtt_circ_init(&_mqtt.rxbuff);
+    /* Keep ids of measurements waiting in window unique over reconnect. */
+    if (message_id)
+        _mqtt.message_id = message_id;
+}
+
+static bool _mqttclient_umqtt_keep_alive(struct umqtt_connection *conn) {
+    return umqtt_ping(conn);
 }
 
-static void _mqttclient_umqtt_keep_alive(struct umqtt_connection *conn) {
-    umqtt_ping(conn);
+static void _mqttclient_handle_message(struct umqtt_connection *conn, enum umqtt_message_part part, uint8_t *data, uint16_t len) {
 }
 
-static void _mqttclient_handle_message(struct umqtt_connection *conn, char *topic, uint8_t *data, uint16_t len) {
+static void _mqttclient_handle_puback(struct umqtt_connection *conn, uint16_t message_id) {
+    struct mqttclient_measurement *m;
+    uint8_t topic;
+
+    for (m = _window; m < _window + MQTT_PUBLISH_WINDOW; m++) {
+        for (topic = 0; topic < MQTTCLIENT_TOPICS; topic++) {
+            if ((m->unacked & _BV(topic)) && m->message_id[topic] == message_id) {
+                m->unacked &= ~_BV(topic);
+                return;
+            }
+        }
+    }
 }
 
 static inline void _mqttclient_send(void) {
     actsig_notify(&_broker_signal);
-    uip_send(_mqttclient_send_buffer, _mqttclient_send_length);
+    /* Data is already in place, uip_send() won't copy it. */
+    uip_send(uip_appdata, umqtt_circ_datalen(&_mqtt.txbuff));
 }
 
 static inline void _mqttclient_signal_connected(void) {
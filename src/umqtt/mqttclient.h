@@ -18,6 +18,8 @@
 #ifndef __MQTTCLIENT_H__
 #define __MQTTCLIENT_H__
 
+#include "../uip/clock.h"
+
 enum mqttclient_state {
     MQTTCLIENT_BROKER_DISCONNECTED,
     MQTTCLIENT_BROKER_DISCONNECTED_WAIT,
@@ -30,4 +32,9 @@ void mqttclient_init(void);
 void mqttclient_process(void);
 void mqttclient_appcall(void);
 
+/**
+ * @return Clock ticks until next timer of MQTT client expires, 0 if work is due.
+ */
+clock_time_t mqttclient_remaining(void);
+
 #endif
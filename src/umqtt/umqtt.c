@@ -13,15 +13,18 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <stdbool.h>
 #include <string.h>
 #include <avr/io.h>
+#include <avr/pgmspace.h>
+#include "../common.h"
 #include "umqtt.h"
 
-#define umqtt_insert_messageid(conn, ptr)   \
-    do {                                    \
-        ptr[0] = conn->message_id >> 8;     \
-        ptr[1] = conn->message_id & 0xff;   \
-        conn->message_id++;                 \
+#define umqtt_insert_messageid(conn, ptr)           \
+    do {                                            \
+        uint16_t _id = umqtt_message_id(conn);      \
+        ptr[0] = _id >> 8;                          \
+        ptr[1] = _id & 0xff;                        \
     } while (0)
 
 #define umqtt_header_type(h) \
@@ -45,12 +48,151 @@ static inline uint8_t _umqtt_build_header(enum umqtt_packet_type type, uint8_t d
  */
 static uint16_t _umqtt_encode_length(int16_t len, uint8_t *data);
 
+/** Maximum number of bytes of remaining length field. */
+#define UMQTT_LENGTH_MAX_BYTES  4
+
+/** Topic string is in program memory. */
+#define UMQTT_SOURCE_TOPIC_P    _BV(0)
+/** Payload is in program memory. */
+#define UMQTT_SOURCE_DATA_P     _BV(1)
+
+/**
+ * Encode CONNECT packet.
+ *
+ * @param progmem True when strings and will message are in program memory.
+ */
+static bool _umqtt_connect(struct umqtt_connection *conn, struct umqtt_connect_config *config, bool progmem);
+
+/**
+ * Encode SUBSCRIBE packet.
+ *
+ * @param progmem True when topic is in program memory.
+ */
+static bool _umqtt_subscribe(struct umqtt_connection *conn, const char *topic, bool progmem);
+
+/**
+ * Encode PUBLISH packet.
+ *
+ * @param topic Topic name or NULL.
+ * @param ptopic Topic in program memory, used when topic is NULL.
+ * @param message_id Message id for QoS 1, zero for QoS 0.
+ * @param source UMQTT_SOURCE_* flags.
+ */
+static bool _umqtt_publish(struct umqtt_connection *conn, const char *topic, const struct umqtt_topic *ptopic, const uint8_t *data, uint16_t datalen, uint8_t flags, uint16_t message_id, uint8_t source);
+
+/**
+ * String length.
+ *
+ * @param progmem True when string is in program memory.
+ */
+static inline uint16_t _umqtt_strlen(const char *str, bool progmem);
+
+/**
+ * Push data to TX buffer. Space must be checked before.
+ *
+ * @param progmem True when data are in program memory.
+ */
+static void _umqtt_tx_push(struct umqtt_connection *conn, const void *data, uint16_t len, bool progmem);
+
+/**
+ * Push field prefixed by its length to TX buffer. Space must be checked before.
+ *
+ * @param progmem True when data are in program memory.
+ */
+static void _umqtt_tx_push_field(struct umqtt_connection *conn, const void *data, uint16_t len, bool progmem);
+
+/**
+ * Push data from program memory to buffer.
+ *
+ * @param buff Pointer to buffer object.
+ * @param data Data in program memory.
+ * @param len Data length. Must fit into buffer.
+ */
+static void _umqtt_circ_push_P(struct umqtt_circ_buffer *buff, PGM_VOID_P data, uint16_t len);
+
+/**
+ * Length of data which can be read from buffer without wrapping.
+ *
+ * @param buff Pointer to buffer object.
+ */
+static inline uint16_t _umqtt_circ_span(struct umqtt_circ_buffer *buff);
+
+/**
+ * Drop data from buffer.
+ *
+ * @param buff Pointer to buffer object.
+ * @param len Number of bytes to drop. Must not exceed data length.
+ */
+static void _umqtt_circ_skip(struct umqtt_circ_buffer *buff, uint16_t len);
+
+/**
+ * Do one step of incoming packet parser. Consumes at least one byte from RX
+ * buffer, which must not be empty.
+ *
+ * @param conn Connection object.
+ */
+static void _umqtt_rx_step(struct umqtt_connection *conn);
+
+/**
+ * Read fixed length field into work buffer.
+ *
+ * @param conn Connection object.
+ * @param len Field length.
+ * @return True when whole field is read.
+ */
+static bool _umqtt_rx_collect(struct umqtt_connection *conn, uint8_t len);
+
+/**
+ * Pass chunk of PUBLISH topic or payload to message callback.
+ *
+ * @param conn Connection object.
+ * @param part Message part.
+ * @param len Number of bytes left in this part.
+ * @return Number of bytes passed.
+ */
+static uint16_t _umqtt_rx_stream(struct umqtt_connection *conn, enum umqtt_message_part part, uint32_t len);
+
 /**
- * Decode length field.
+ * Continue after remaining length or PUBLISH field is read. Handles empty
+ * fields and packet end.
+ *
+ * @param conn Connection object.
+ * @param state Next state.
  */
-static uint16_t umqtt_decode_length(uint8_t *data);
+static void _umqtt_rx_next(struct umqtt_connection *conn, enum umqtt_rx_state state);
 
-static void _umqtt_create_field(uint8_t *dst, uint8_t *src, uint16_t len);
+/**
+ * Whole packet was read.
+ *
+ * @param conn Connection object.
+ */
+static void _umqtt_rx_packet_done(struct umqtt_connection *conn);
+
+#if UMQTT_PROTOCOL_V5
+/**
+ * Do one step of MQTT 5 property scanner. Properties are skipped, except
+ * those used by this client.
+ *
+ * @param conn Connection object.
+ */
+static void _umqtt_rx_property(struct umqtt_connection *conn);
+
+/**
+ * Continue after properties of current packet are read.
+ *
+ * @param conn Connection object.
+ */
+static void _umqtt_rx_properties_done(struct umqtt_connection *conn);
+#endif
+
+/**
+ * Check free space in TX buffer.
+ *
+ * @param conn Connection object.
+ * @param len Length of packet to be queued.
+ * @return True if len bytes fits into TX buffer.
+ */
+static inline bool _umqtt_tx_fits(struct umqtt_connection *conn, uint16_t len);
 
 void umqtt_circ_init(struct umqtt_circ_buffer *buff) {
     buff->pointer = buff->start;
@@ -58,48 +200,97 @@ void umqtt_circ_init(struct umqtt_circ_buffer *buff) {
 }
 
 int16_t umqtt_circ_push(struct umqtt_circ_buffer *buff, uint8_t *data, int16_t len) {
-    uint8_t *bend = buff->start + buff->length - 1;
-    /* This points to new byte */
-    uint8_t *dend = (buff->pointer - buff->start + buff->datalen) % buff->length + buff->start;
-
-    for (; len > 0; len--) {
-        if (dend > bend)
-            dend = buff->start;
-        if (buff->datalen != 0 && dend == buff->pointer)
-            break;
-        *dend = *data;
-        dend++;
-        data++;
-        buff->datalen++;
+    uint16_t space = buff->length - buff->datalen;
+    uint8_t *end;
+    uint8_t *dst;
+    uint16_t count;
+    uint16_t tail;
+    uint16_t span;
+
+    if (len <= UMQTT_CIRC_SMALL && len <= space) {
+        /*
+         * Header bytes come one or two at a time. Moving them directly is
+         * cheaper than index wrapping, split and two memcpy() calls.
+         */
+        end = buff->start + buff->length;
+        dst = buff->pointer + buff->datalen;
+        if (dst >= end)
+            dst -= buff->length;
+        for (count = len; count > 0; count--) {
+            *dst++ = *data++;
+            if (dst == end)
+                dst = buff->start;
+        }
+        buff->datalen += len;
+        return 0;
     }
-    return len; /* Return amount of bytes left */
+
+    tail = umqtt_circ_wrap(buff, buff->pointer - buff->start + buff->datalen);
+    count = min(len, space);
+    /* At most two copies: up to the end of buffer and from its start. */
+    span = min(count, buff->length - tail);
+    memcpy(buff->start + tail, data, span);
+    memcpy(buff->start, data + span, count - span);
+    buff->datalen += count;
+    return len - count; /* Return amount of bytes left */
 }
 
 int16_t umqtt_circ_peek(struct umqtt_circ_buffer *buff, uint8_t *data, int16_t len) {
-    uint8_t *ptr = buff->pointer;
-    uint8_t *bend = buff->start + buff->length - 1;
-    int16_t i;
+    uint16_t count = min(len, buff->datalen);
+    uint16_t span = min(count, buff->start + buff->length - buff->pointer);
 
-    for (i = 0; i < len && i < buff->datalen; i++) {
-        data[i] = ptr[i];
-        if (ptr > bend)
-            ptr = buff->start;
-    }
-    return i; /* Return the amount of bytes actually peeked */
+    memcpy(data, buff->pointer, span);
+    memcpy(data + span, buff->start, count - span);
+    return count; /* Return the amount of bytes actually peeked */
 }
 
 int16_t umqtt_circ_pop(struct umqtt_circ_buffer *buff, uint8_t *data, int16_t len) {
-    uint8_t *bend = buff->start + buff->length - 1;
+    uint8_t *end;
+    uint8_t *src;
+    int16_t count;
     int16_t i;
 
-    for (i = 0; i < len && buff->datalen > 0; i++) {
-        data[i] = *buff->pointer;
-        buff->pointer++;
-        buff->datalen--;
-        if (buff->pointer > bend)
-            buff->pointer = buff->start;
+    if (len <= UMQTT_CIRC_SMALL && len <= buff->datalen) {
+        /* Parser pops single bytes, skip memcpy() and index wrapping. */
+        end = buff->start + buff->length;
+        src = buff->pointer;
+        for (i = len; i > 0; i--) {
+            *data++ = *src++;
+            if (src == end)
+                src = buff->start;
+        }
+        buff->datalen -= len;
+        /* Rewind empty buffer, next push will be a single copy. */
+        buff->pointer = buff->datalen == 0 ? buff->start : src;
+        return len;
+    }
+
+    count = umqtt_circ_peek(buff, data, len);
+    _umqtt_circ_skip(buff, count);
+    return count; /* Return the amount of bytes actually popped */
+}
+
+static void _umqtt_circ_push_P(struct umqtt_circ_buffer *buff, PGM_VOID_P data, uint16_t len) {
+    uint16_t tail = umqtt_circ_wrap(buff, buff->pointer - buff->start + buff->datalen);
+    uint16_t span = min(len, buff->length - tail);
+
+    memcpy_P(buff->start + tail, data, span);
+    memcpy_P(buff->start, (const uint8_t *) data + span, len - span);
+    buff->datalen += len;
+}
+
+static inline uint16_t _umqtt_circ_span(struct umqtt_circ_buffer *buff) {
+    return min(buff->datalen, buff->start + buff->length - buff->pointer);
+}
+
+static void _umqtt_circ_skip(struct umqtt_circ_buffer *buff, uint16_t len) {
+    buff->datalen -= len;
+    if (buff->datalen == 0) {
+        /* Rewind empty buffer, next push will be a single copy. */
+        buff->pointer = buff->start;
+    } else {
+        buff->pointer = buff->start + umqtt_circ_wrap(buff, buff->pointer - buff->start + len);
     }
-    return i; /* Return the amount of bytes actually popped */
 }
 
 void umqtt_init(struct umqtt_connection *conn) {
@@ -108,21 +299,49 @@ void umqtt_init(struct umqtt_connection *conn) {
     conn->nack_publish = 0;
     conn->nack_subscribe = 0;
     conn->message_id = 1; /* Id 0 is reserved */
+    conn->session_present = false;
+    conn->rx_state = UMQTT_RX_HEADER;
+#if UMQTT_PROTOCOL_V5
+    conn->rx_prop = 0;
+    conn->topic_alias_max = 0;
+    conn->alias_known = 0;
+    conn->alias_sent = 0;
+#endif
 }
 
-void umqtt_connect(struct umqtt_connection *conn, struct umqtt_connect_config *config) {
-    uint16_t cidlen = strlen(config->client_id);
+bool umqtt_connect(struct umqtt_connection *conn, struct umqtt_connect_config *config) {
+    return _umqtt_connect(conn, config, false);
+}
+
+bool umqtt_connect_P(struct umqtt_connection *conn, const struct umqtt_connect_config *config) {
+    struct umqtt_connect_config copy;
+
+    memcpy_P(&copy, config, sizeof(copy));
+    return _umqtt_connect(conn, &copy, true);
+}
+
+static bool _umqtt_connect(struct umqtt_connection *conn, struct umqtt_connect_config *config, bool progmem) {
+    uint16_t cidlen = _umqtt_strlen(config->client_id, progmem);
 
     /* Check for non-zero client ID. */
     if (cidlen == 0)
-        return;
+        return false;
     uint16_t will_topic_len = 0;
     if (config->will_topic != NULL)
-        will_topic_len = strlen(config->will_topic);
+        will_topic_len = _umqtt_strlen(config->will_topic, progmem);
     uint8_t fixed = _umqtt_build_header(UMQTT_CONNECT, 0, 0, 0);
     uint8_t remlen[4];
 
-    uint8_t flags = _BV(UMQTT_CONNECT_FLAG_CLEAN_SESSION);
+    uint8_t flags = 0;
+#if UMQTT_PROTOCOL_V5
+    uint32_t expiry = 0;
+
+    if (config->flags & _BV(UMQTT_OPT_PERSISTENT))
+        expiry = UMQTT_SESSION_EXPIRY;
+#endif
+
+    if (!(config->flags & _BV(UMQTT_OPT_PERSISTENT)))
+        flags |= _BV(UMQTT_CONNECT_FLAG_CLEAN_SESSION);
 
     /* Last will related flags. */
     if (will_topic_len > 0) {
@@ -148,97 +367,504 @@ void umqtt_connect(struct umqtt_connection *conn, struct umqtt_connect_config *c
         /* Keep alive. */
         config->keep_alive >> 8,
         config->keep_alive & 0xff,
+#if UMQTT_PROTOCOL_V5
+
+        /* Session expiry, 0 ends session with network connection. */
+        5,
+        UMQTT_PROPERTY_SESSION_EXPIRY,
+        expiry >> 24,
+        (expiry >> 16) & 0xff,
+        (expiry >> 8) & 0xff,
+        expiry & 0xff,
+#endif
     };
     uint16_t payload_len = 2 + cidlen;
     if (will_topic_len > 0)
-        payload_len += 2 + will_topic_len + 2 + config->will_message_len;
-    uint8_t payload[payload_len];
+        payload_len += UMQTT_PROTOCOL_V5 + 2 + will_topic_len + 2 + config->will_message_len;
 
-    _umqtt_create_field(payload, (uint8_t *) config->client_id, cidlen);
-    if (will_topic_len > 0) {
-        _umqtt_create_field(payload + 2 + cidlen, (uint8_t *) config->will_topic, will_topic_len);
-        _umqtt_create_field(payload + 2 + cidlen + 2 + will_topic_len, config->will_message, config->will_message_len);
-    }
+    uint16_t remlen_len = _umqtt_encode_length(sizeof(variable) + payload_len, remlen);
+    if (!_umqtt_tx_fits(conn, 1 + remlen_len + sizeof(variable) + payload_len))
+        return false;
 
     umqtt_circ_push(&conn->txbuff, &fixed, 1);
-    umqtt_circ_push(&conn->txbuff, remlen, _umqtt_encode_length(sizeof(variable) + payload_len, remlen));
+    umqtt_circ_push(&conn->txbuff, remlen, remlen_len);
     umqtt_circ_push(&conn->txbuff, variable, sizeof(variable));
-    umqtt_circ_push(&conn->txbuff, payload, payload_len);
 
+    /* Payload fields go straight to TX buffer. */
+    _umqtt_tx_push_field(conn, config->client_id, cidlen, progmem);
+    if (will_topic_len > 0) {
+#if UMQTT_PROTOCOL_V5
+        /* No will properties. */
+        _umqtt_tx_push(conn, "", 1, false);
+#endif
+        _umqtt_tx_push_field(conn, config->will_topic, will_topic_len, progmem);
+        _umqtt_tx_push_field(conn, config->will_message, config->will_message_len, progmem);
+    }
+
+#if UMQTT_PROTOCOL_V5
+    /* Aliases are valid within single network connection. */
+    conn->alias_known = 0;
+    conn->alias_sent = 0;
+#endif
     conn->state = UMQTT_STATE_CONNECTING;
+    return true;
+}
+
+bool umqtt_subscribe(struct umqtt_connection *conn, char *topic) {
+    return _umqtt_subscribe(conn, topic, false);
+}
+
+bool umqtt_subscribe_P(struct umqtt_connection *conn, const char *topic) {
+    return _umqtt_subscribe(conn, topic, true);
 }
 
-void umqtt_subscribe(struct umqtt_connection *conn, char *topic) {
-    uint16_t topiclen = strlen(topic);
+static bool _umqtt_subscribe(struct umqtt_connection *conn, const char *topic, bool progmem) {
+    uint16_t topiclen = _umqtt_strlen(topic, progmem);
     uint8_t fixed = _umqtt_build_header(UMQTT_SUBSCRIBE, 0, 1, 0);
     uint8_t remlen[4];
-    uint8_t messageid[2];
-    uint8_t payload[2 + topiclen + 1];
+    uint8_t messageid[2 + UMQTT_PROTOCOL_V5]; /* Followed by empty properties with MQTT 5. */
+    uint8_t qos = UMQTT_QOS_0;
+    uint16_t remlen_len = _umqtt_encode_length(sizeof(messageid) + 2 + topiclen + sizeof(qos), remlen);
 
-    umqtt_insert_messageid(conn, messageid);
+    if (!_umqtt_tx_fits(conn, 1 + remlen_len + sizeof(messageid) + 2 + topiclen + sizeof(qos)))
+        return false;
 
-    _umqtt_create_field(payload, (uint8_t *) topic, topiclen);
-    payload[2 + topiclen] = 0; /* QoS */
+    umqtt_insert_messageid(conn, messageid);
+#if UMQTT_PROTOCOL_V5
+    messageid[2] = 0;
+#endif
 
     umqtt_circ_push(&conn->txbuff, &fixed, 1);
-    umqtt_circ_push(&conn->txbuff, remlen, _umqtt_encode_length(sizeof(messageid) + sizeof(payload), remlen));
+    umqtt_circ_push(&conn->txbuff, remlen, remlen_len);
     umqtt_circ_push(&conn->txbuff, messageid, sizeof(messageid));
-    umqtt_circ_push(&conn->txbuff, payload, sizeof(payload));
+    _umqtt_tx_push_field(conn, topic, topiclen, progmem);
+    umqtt_circ_push(&conn->txbuff, &qos, sizeof(qos));
 
     conn->nack_subscribe++;
+    return true;
+}
+
+bool umqtt_publish(struct umqtt_connection *conn, char *topic, uint8_t *data, uint16_t datalen, uint8_t flags) {
+    return _umqtt_publish(conn, topic, NULL, data, datalen, flags & ~_BV(UMQTT_OPT_DUP), 0, 0);
+}
+
+bool umqtt_publish_P(struct umqtt_connection *conn, const char *topic, const uint8_t *data, uint16_t datalen, uint8_t flags) {
+    return _umqtt_publish(conn, topic, NULL, data, datalen, flags & ~_BV(UMQTT_OPT_DUP), 0,
+                          UMQTT_SOURCE_TOPIC_P | UMQTT_SOURCE_DATA_P);
 }
 
-void umqtt_publish(struct umqtt_connection *conn, char *topic, uint8_t *data, uint16_t datalen, uint8_t flags) {
-    uint16_t toplen = strlen(topic);
+bool umqtt_publish_topic(struct umqtt_connection *conn, const struct umqtt_topic *topic, uint8_t *data, uint16_t datalen, uint8_t flags, uint16_t message_id) {
+    if (!message_id)
+        flags &= ~_BV(UMQTT_OPT_DUP);
+    if (!_umqtt_publish(conn, NULL, topic, data, datalen, flags, message_id, 0))
+        return false;
+    if (message_id)
+        conn->nack_publish++;
+    return true;
+}
+
+void umqtt_tx_mark(struct umqtt_connection *conn, struct umqtt_tx_mark *mark) {
+    mark->datalen = conn->txbuff.datalen;
+    mark->nack_publish = conn->nack_publish;
+    mark->nack_ping = conn->nack_ping;
+#if UMQTT_PROTOCOL_V5
+    mark->alias_sent = conn->alias_sent;
+#endif
+}
+
+void umqtt_tx_rollback(struct umqtt_connection *conn, struct umqtt_tx_mark *mark) {
+    /* TX buffer is only appended to, so dropping tail is enough. */
+    conn->txbuff.datalen = mark->datalen;
+    conn->nack_publish = mark->nack_publish;
+    conn->nack_ping = mark->nack_ping;
+#if UMQTT_PROTOCOL_V5
+    conn->alias_sent = mark->alias_sent;
+#endif
+}
+
+void umqtt_tx_repeated(struct umqtt_connection *conn, struct umqtt_tx_mark *mark) {
+    conn->nack_publish = mark->nack_publish;
+    conn->nack_ping = mark->nack_ping;
+}
+
+void umqtt_tx_acked(struct umqtt_connection *conn) {
+#if UMQTT_PROTOCOL_V5
+    conn->alias_known |= conn->alias_sent;
+    conn->alias_sent = 0;
+#endif
+}
+
+uint16_t umqtt_message_id(struct umqtt_connection *conn) {
+    /* Id 0 is reserved. */
+    if (conn->message_id == 0)
+        conn->message_id++;
+    return conn->message_id++;
+}
+
+static bool _umqtt_publish(struct umqtt_connection *conn, const char *topic, const struct umqtt_topic *ptopic, const uint8_t *data, uint16_t datalen, uint8_t flags, uint16_t message_id, uint8_t source) {
+    uint16_t toplen;
     uint8_t retain = flags & _BV(UMQTT_OPT_RETAIN) ? 1 : 0;
-    uint8_t fixed = _umqtt_build_header(UMQTT_PUBLISH, 0, 0, retain);
+    uint8_t dup = flags & _BV(UMQTT_OPT_DUP) ? 1 : 0;
+    uint8_t qos = message_id ? UMQTT_QOS_1 : UMQTT_QOS_0;
+    uint8_t fixed = _umqtt_build_header(UMQTT_PUBLISH, dup, qos, retain);
     uint8_t remlen[4];
-    uint8_t len[2];
+    uint8_t id[2];
+#if UMQTT_PROTOCOL_V5
+    uint8_t properties[] = {
+        0,      /* Properties length. */
+        UMQTT_PROPERTY_TOPIC_ALIAS,
+        0,
+        0,      /* Alias. */
+    };
+    uint8_t properties_len = 1;
+    uint8_t alias = 0;
+#endif
+
+    if (topic != NULL)
+        toplen = _umqtt_strlen(topic, source & UMQTT_SOURCE_TOPIC_P);
+    else
+        toplen = (pgm_read_byte(&ptopic->length[0]) << 8) | pgm_read_byte(&ptopic->length[1]);
+
+#if UMQTT_PROTOCOL_V5
+    if (topic == NULL)
+        alias = pgm_read_byte(&ptopic->alias);
+    /* Alias can be used only up to maximum announced by broker. */
+    if (alias > UMQTT_TOPIC_ALIAS_MAX || alias > conn->topic_alias_max)
+        alias = 0;
+    if (alias) {
+        properties[0] = sizeof(properties) - 1;
+        properties[3] = alias;
+        properties_len = sizeof(properties);
+        /* Topic name is omitted once broker knows the alias. */
+        if (conn->alias_known & _BV(alias - 1))
+            toplen = 0;
+    }
+    uint16_t varlen = 2 + toplen + (qos ? sizeof(id) : 0) + properties_len;
+#else
+    uint16_t varlen = 2 + toplen + (qos ? sizeof(id) : 0);
+#endif
+    uint16_t remlen_len = _umqtt_encode_length(varlen + datalen, remlen);
+
+    if (!_umqtt_tx_fits(conn, 1 + remlen_len + varlen + datalen))
+        return false;
 
     umqtt_circ_push(&conn->txbuff, &fixed, 1);
-    umqtt_circ_push(&conn->txbuff, remlen, _umqtt_encode_length(2 + toplen + datalen, remlen));
+    umqtt_circ_push(&conn->txbuff, remlen, remlen_len);
 
-    len[0] = toplen >> 8;
-    len[1] = toplen & 0xff;
-    umqtt_circ_push(&conn->txbuff, len, sizeof(len));
-    umqtt_circ_push(&conn->txbuff, (uint8_t *) topic, toplen);
+    if (topic == NULL && toplen > 0) {
+        /* Length prefix and name in single copy. */
+        _umqtt_circ_push_P(&conn->txbuff, ptopic->length, sizeof(ptopic->length) + toplen);
+    } else {
+        _umqtt_tx_push_field(conn, topic, toplen, source & UMQTT_SOURCE_TOPIC_P);
+    }
 
-    umqtt_circ_push(&conn->txbuff, data, datalen);
+    if (qos) {
+        id[0] = message_id >> 8;
+        id[1] = message_id & 0xff;
+        umqtt_circ_push(&conn->txbuff, id, sizeof(id));
+    }
+
+#if UMQTT_PROTOCOL_V5
+    umqtt_circ_push(&conn->txbuff, properties, properties_len);
+    if (alias)
+        conn->alias_sent |= _BV(alias - 1);
+#endif
+
+    _umqtt_tx_push(conn, data, datalen, source & UMQTT_SOURCE_DATA_P);
+    return true;
 }
 
-void umqtt_ping(struct umqtt_connection *conn) {
+bool umqtt_ping(struct umqtt_connection *conn) {
     uint8_t packet[] = {
         _umqtt_build_header(UMQTT_PINGREQ, 0, 0, 0),
         0,
     };
 
+    if (!_umqtt_tx_fits(conn, sizeof(packet)))
+        return false;
+
     umqtt_circ_push(&conn->txbuff, packet, sizeof(packet));
     conn->nack_ping++;
+    return true;
 }
 
-static void umqtt_handle_publish(struct umqtt_connection *conn, uint8_t *data, int16_t len) {
-    uint16_t toplen = (data[0] << 8) | data[1];
-    char topic[toplen + 1];
-    uint8_t payload[len - 2 - toplen];
+void umqtt_process(struct umqtt_connection *conn) {
+    while (umqtt_circ_datalen(&conn->rxbuff) > 0)
+        _umqtt_rx_step(conn);
+}
 
-    memcpy(topic, data + 2, sizeof(topic));
-    topic[sizeof(topic) - 1] = 0;
-    memcpy(payload, data + 2 + toplen, sizeof(payload));
+static void _umqtt_rx_step(struct umqtt_connection *conn) {
+    uint8_t byte;
+    uint16_t count;
 
-    conn->message_callback(conn, topic, payload, sizeof(payload));
+    switch (conn->rx_state) {
+        case UMQTT_RX_HEADER:
+            umqtt_circ_pop(&conn->rxbuff, &conn->rx_header, 1);
+            conn->rx_remaining = 0;
+            conn->rx_work_len = 0;
+            conn->rx_state = UMQTT_RX_LENGTH;
+            break;
+        case UMQTT_RX_LENGTH:
+            umqtt_circ_pop(&conn->rxbuff, &byte, 1);
+            conn->rx_remaining |= (uint32_t) (byte & 0x7f) << (7 * conn->rx_work_len);
+            conn->rx_work_len++;
+            if (byte & 0x80) {
+                if (conn->rx_work_len == UMQTT_LENGTH_MAX_BYTES) {
+                    /* Malformed length, stream can't be synchronized again. */
+                    conn->state = UMQTT_STATE_FAILED;
+                    conn->rx_state = UMQTT_RX_HEADER;
+                }
+                break;
+            }
+            conn->rx_work_len = 0;
+            if (umqtt_header_type(conn->rx_header) == UMQTT_PUBLISH)
+                _umqtt_rx_next(conn, UMQTT_RX_TOPIC_LEN);
+#if UMQTT_PROTOCOL_V5
+            else if (umqtt_header_type(conn->rx_header) == UMQTT_CONNACK)
+                _umqtt_rx_next(conn, UMQTT_RX_CONNACK);
+#endif
+            else
+                _umqtt_rx_next(conn, UMQTT_RX_BODY);
+            break;
+        case UMQTT_RX_TOPIC_LEN:
+            if (_umqtt_rx_collect(conn, 2)) {
+                conn->rx_field = (conn->rx_work[0] << 8) | conn->rx_work[1];
+                conn->rx_work_len = 0;
+                _umqtt_rx_next(conn, UMQTT_RX_TOPIC);
+            } else {
+                /* Packet may end before the whole field. */
+                _umqtt_rx_next(conn, UMQTT_RX_TOPIC_LEN);
+            }
+            break;
+        case UMQTT_RX_TOPIC:
+            conn->rx_field -= _umqtt_rx_stream(conn, UMQTT_MESSAGE_TOPIC, min(conn->rx_field, conn->rx_remaining));
+            if (conn->rx_field == 0) {
+                /* QoS 0 messages have no message id. */
+                if (conn->rx_header & (UMQTT_QOS_2 << 1 | UMQTT_QOS_1 << 1))
+                    _umqtt_rx_next(conn, UMQTT_RX_MESSAGE_ID);
+#if UMQTT_PROTOCOL_V5
+                else
+                    _umqtt_rx_next(conn, UMQTT_RX_PROPERTIES_LEN);
+#else
+                else
+                    _umqtt_rx_next(conn, UMQTT_RX_PAYLOAD);
+#endif
+            } else {
+                _umqtt_rx_next(conn, UMQTT_RX_TOPIC);
+            }
+            break;
+        case UMQTT_RX_MESSAGE_ID:
+            if (_umqtt_rx_collect(conn, 2)) {
+#if UMQTT_PROTOCOL_V5
+                _umqtt_rx_next(conn, UMQTT_RX_PROPERTIES_LEN);
+#else
+                _umqtt_rx_next(conn, UMQTT_RX_PAYLOAD);
+#endif
+            } else {
+                _umqtt_rx_next(conn, UMQTT_RX_MESSAGE_ID);
+            }
+            break;
+        case UMQTT_RX_PAYLOAD:
+            _umqtt_rx_stream(conn, UMQTT_MESSAGE_PAYLOAD, conn->rx_remaining);
+            _umqtt_rx_next(conn, UMQTT_RX_PAYLOAD);
+            break;
+        case UMQTT_RX_BODY:
+            /* Keep beginning of body, drop the rest. */
+            if (conn->rx_work_len < sizeof(conn->rx_work)) {
+                _umqtt_rx_collect(conn, sizeof(conn->rx_work));
+            } else {
+                count = min(conn->rx_remaining, _umqtt_circ_span(&conn->rxbuff));
+                _umqtt_circ_skip(&conn->rxbuff, count);
+                conn->rx_remaining -= count;
+            }
+            _umqtt_rx_next(conn, UMQTT_RX_BODY);
+            break;
+#if UMQTT_PROTOCOL_V5
+        case UMQTT_RX_CONNACK:
+            /* Flags and reason code stay in work buffer for packet end. */
+            if (_umqtt_rx_collect(conn, 2))
+                _umqtt_rx_next(conn, UMQTT_RX_PROPERTIES_LEN);
+            else
+                _umqtt_rx_next(conn, UMQTT_RX_CONNACK);
+            break;
+        case UMQTT_RX_PROPERTIES_LEN:
+            if (conn->rx_prop == 0)
+                conn->rx_value = 0;
+            umqtt_circ_pop(&conn->rxbuff, &byte, 1);
+            conn->rx_remaining--;
+            conn->rx_value |= (uint32_t) (byte & 0x7f) << (7 * conn->rx_prop);
+            conn->rx_prop++;
+            if (byte & 0x80) {
+                if (conn->rx_prop == UMQTT_LENGTH_MAX_BYTES) {
+                    conn->state = UMQTT_STATE_FAILED;
+                    conn->rx_state = UMQTT_RX_HEADER;
+                } else {
+                    _umqtt_rx_next(conn, UMQTT_RX_PROPERTIES_LEN);
+                }
+                break;
+            }
+            conn->rx_field = min(conn->rx_value, conn->rx_remaining);
+            conn->rx_prop = 0;
+            conn->rx_prop_skip = false;
+            if (conn->rx_field == 0)
+                _umqtt_rx_properties_done(conn);
+            else
+                _umqtt_rx_next(conn, UMQTT_RX_PROPERTIES);
+            break;
+        case UMQTT_RX_PROPERTIES:
+            _umqtt_rx_property(conn);
+            if (conn->rx_field == 0)
+                _umqtt_rx_properties_done(conn);
+            else
+                _umqtt_rx_next(conn, UMQTT_RX_PROPERTIES);
+            break;
+#endif
+    }
+}
+
+#if UMQTT_PROTOCOL_V5
+static void _umqtt_rx_property(struct umqtt_connection *conn) {
+    uint8_t byte;
+    uint16_t count;
+
+    if (conn->rx_prop_skip) {
+        /* String or binary data, nothing of it is used. */
+        count = min(min(conn->rx_prop_left, conn->rx_field), _umqtt_circ_span(&conn->rxbuff));
+        _umqtt_circ_skip(&conn->rxbuff, count);
+        conn->rx_remaining -= count;
+        conn->rx_field -= count;
+        conn->rx_prop_left -= count;
+        if (conn->rx_prop_left > 0)
+            return;
+        conn->rx_prop_skip = false;
+        if (--conn->rx_prop_strings > 0) {
+            /* Second string of user property. */
+            conn->rx_prop_left = 2;
+            conn->rx_value = 0;
+        } else {
+            conn->rx_prop = 0;
+        }
+        return;
+    }
+
+    umqtt_circ_pop(&conn->rxbuff, &byte, 1);
+    conn->rx_remaining--;
+    conn->rx_field--;
+
+    if (conn->rx_prop == 0) {
+        conn->rx_prop = byte;
+        conn->rx_prop_strings = 0;
+        conn->rx_value = 0;
+        switch (byte) {
+            case 0x01: case 0x17: case 0x19: case 0x24:
+            case 0x25: case 0x28: case 0x29: case 0x2a:
+                conn->rx_prop_left = 1;
+                break;
+            case 0x13: case 0x21:
+            case UMQTT_PROPERTY_TOPIC_ALIAS_MAXIMUM:
+            case UMQTT_PROPERTY_TOPIC_ALIAS:
+                conn->rx_prop_left = 2;
+                break;
+            case 0x02: case 0x11: case 0x18: case 0x27:
+                conn->rx_prop_left = 4;
+                break;
+            case UMQTT_PROPERTY_SUBSCRIPTION_ID:
+                conn->rx_prop_left = 1;
+                break;
+            case 0x26:
+                /* User property is string pair. */
+                conn->rx_prop_strings = 2;
+                conn->rx_prop_left = 2;
+                break;
+            case 0x03: case 0x08: case 0x09: case 0x12:
+            case 0x15: case 0x16: case 0x1a: case 0x1c: case 0x1f:
+                conn->rx_prop_strings = 1;
+                conn->rx_prop_left = 2;
+                break;
+            default:
+                /* Unknown property, its length is unknown too. Drop the rest. */
+                conn->rx_prop_skip = true;
+                conn->rx_prop_strings = 1;
+                conn->rx_prop_left = conn->rx_field;
+                break;
+        }
+        return;
+    }
+
+    if (conn->rx_prop == UMQTT_PROPERTY_SUBSCRIPTION_ID) {
+        /* Variable byte integer, value is not used. */
+        if (!(byte & 0x80))
+            conn->rx_prop = 0;
+        return;
+    }
+
+    conn->rx_value = (conn->rx_value << 8) | byte;
+    if (--conn->rx_prop_left > 0)
+        return;
+
+    if (conn->rx_prop_strings > 0) {
+        /* String length is read, skip its data. */
+        conn->rx_prop_left = conn->rx_value;
+        conn->rx_prop_skip = true;
+        return;
+    }
+
+    if (conn->rx_prop == UMQTT_PROPERTY_TOPIC_ALIAS_MAXIMUM)
+        conn->topic_alias_max = conn->rx_value;
+    conn->rx_prop = 0;
+}
+
+static void _umqtt_rx_properties_done(struct umqtt_connection *conn) {
+    conn->rx_prop = 0;
+    if (umqtt_header_type(conn->rx_header) == UMQTT_PUBLISH)
+        _umqtt_rx_next(conn, UMQTT_RX_PAYLOAD);
+    else
+        _umqtt_rx_next(conn, UMQTT_RX_BODY);
+}
+#endif
+
+static bool _umqtt_rx_collect(struct umqtt_connection *conn, uint8_t len) {
+    uint8_t count = min(len - conn->rx_work_len, conn->rx_remaining);
+
+    count = umqtt_circ_pop(&conn->rxbuff, conn->rx_work + conn->rx_work_len, count);
+    conn->rx_work_len += count;
+    conn->rx_remaining -= count;
+    return conn->rx_work_len == len;
 }
 
-static void umqtt_packet_arrived(struct umqtt_connection *conn, uint8_t header, int16_t len) {
-    uint8_t data[len];
+static uint16_t _umqtt_rx_stream(struct umqtt_connection *conn, enum umqtt_message_part part, uint32_t len) {
+    uint16_t count = min(len, _umqtt_circ_span(&conn->rxbuff));
+
+    /* Pass data in place, without copying them out of RX buffer. */
+    if (conn->message_callback != NULL && count > 0)
+        conn->message_callback(conn, part, conn->rxbuff.pointer, count);
+    _umqtt_circ_skip(&conn->rxbuff, count);
+    conn->rx_remaining -= count;
+    return count;
+}
 
-    umqtt_circ_pop(&conn->rxbuff, data, len);
-    switch (umqtt_header_type(header)) {
+static void _umqtt_rx_next(struct umqtt_connection *conn, enum umqtt_rx_state state) {
+    conn->rx_state = state;
+    if (conn->rx_remaining == 0)
+        _umqtt_rx_packet_done(conn);
+}
+
+static void _umqtt_rx_packet_done(struct umqtt_connection *conn) {
+    switch (umqtt_header_type(conn->rx_header)) {
         case UMQTT_CONNACK:
-            if (data[1] == 0x00)
+            if (conn->rx_work_len >= 2 && conn->rx_work[1] == 0x00) {
                 conn->state = UMQTT_STATE_CONNECTED;
-            else
+                conn->session_present = conn->rx_work[0] & 0x01;
+            } else
                 conn->state = UMQTT_STATE_FAILED;
             break;
+        case UMQTT_PUBACK:
+            if (conn->rx_work_len < 2)
+                break;
+            conn->nack_publish--;
+            if (conn->puback_callback != NULL)
+                conn->puback_callback(conn, (conn->rx_work[0] << 8) | conn->rx_work[1]);
+            break;
         case UMQTT_SUBACK:
             conn->nack_subscribe--;
             break;
@@ -246,21 +872,17 @@ static void umqtt_packet_arrived(struct umqtt_connection *conn, uint8_t header,
             conn->nack_ping--;
             break;
         case UMQTT_PUBLISH:
-            umqtt_handle_publish(conn, data, len);
+            if (conn->message_callback != NULL)
+                conn->message_callback(conn, UMQTT_MESSAGE_END, NULL, 0);
+            break;
+        default:
             break;
     }
-}
-
-void umqtt_process(struct umqtt_connection *conn) {
-    uint8_t buf[5];
-    uint16_t i = 2;
-
-    while (conn->rxbuff.datalen >= 2) { /* We do have the fixed header */
-        umqtt_circ_pop(&conn->rxbuff, buf, 2);
-        for (i = 2; buf[i - 1] & 0x80 && i < sizeof(buf); i++)
-            umqtt_circ_pop(&conn->rxbuff, &buf[i], 1);
-        umqtt_packet_arrived(conn, buf[0], umqtt_decode_length(&buf[1]));
-    }
+#if UMQTT_PROTOCOL_V5
+    /* Packet may end in the middle of property. */
+    conn->rx_prop = 0;
+#endif
+    conn->rx_state = UMQTT_RX_HEADER;
 }
 
 static inline uint8_t _umqtt_build_header(enum umqtt_packet_type type, uint8_t dup, uint8_t qos, uint8_t retain) {
@@ -282,20 +904,29 @@ static uint16_t _umqtt_encode_length(int16_t len, uint8_t *data) {
     return i; /* Return the amount of bytes used */
 }
 
-static uint16_t umqtt_decode_length(uint8_t *data) {
-    uint16_t mul = 1;
-    uint16_t val = 0;
-    uint16_t i;
+static inline uint16_t _umqtt_strlen(const char *str, bool progmem) {
+    return progmem ? strlen_P(str) : strlen(str);
+}
 
-    for (i = 0; i == 0 || (data[i - 1] & 0x80); i++) {
-        val += (data[i] & 0x7f) * mul;
-        mul *= 128;
-    }
-    return val;
+static void _umqtt_tx_push(struct umqtt_connection *conn, const void *data, uint16_t len, bool progmem) {
+    if (len == 0)
+        return;
+    if (progmem)
+        _umqtt_circ_push_P(&conn->txbuff, data, len);
+    else
+        umqtt_circ_push(&conn->txbuff, (uint8_t *) data, len);
+}
+
+static void _umqtt_tx_push_field(struct umqtt_connection *conn, const void *data, uint16_t len, bool progmem) {
+    uint8_t prefix[] = {
+        len >> 8,
+        len & 0xff,
+    };
+
+    umqtt_circ_push(&conn->txbuff, prefix, sizeof(prefix));
+    _umqtt_tx_push(conn, data, len, progmem);
 }
 
-static void _umqtt_create_field(uint8_t *dst, uint8_t *src, uint16_t len) {
-    dst[0] = len >> 8;
-    dst[1] = len & 0xff;
-    memcpy(&dst[2], src, len);
+static inline bool _umqtt_tx_fits(struct umqtt_connection *conn, uint16_t len) {
+    return conn->txbuff.length - conn->txbuff.datalen >= len;
 }
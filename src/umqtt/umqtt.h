@@ -17,8 +17,36 @@
 #ifndef __UMQTT_H__
 #define __UMQTT_H__
 
+#include <stdbool.h>
 #include <stdint.h>
 
+/**
+ * Set to non-zero when all circular buffers have power of two length. Index
+ * wrapping is then done by masking.
+ */
+#ifndef UMQTT_CIRC_POW2
+#define UMQTT_CIRC_POW2     0
+#endif
+
+/**
+ * Wrap index which is less than twice the buffer length.
+ */
+#if UMQTT_CIRC_POW2
+#define umqtt_circ_wrap(buff, index) \
+    ((index) & ((buff)->length - 1))
+#else
+#define umqtt_circ_wrap(buff, index) \
+    ((index) >= (buff)->length ? (index) - (buff)->length : (index))
+#endif
+
+/**
+ * Push and pop of at most this many bytes move them directly through
+ * pointers, longer ones use memcpy().
+ */
+#ifndef UMQTT_CIRC_SMALL
+#define UMQTT_CIRC_SMALL    4
+#endif
+
 #define umqtt_circ_datalen(buff) \
     ((buff)->datalen)
 
@@ -28,8 +56,40 @@
 #define umqtt_circ_is_empty(buff) \
     (umqtt_circ_datalen() == 0)
 
-/** Protocol level fien at MQTT CONNECT message. */
+/**
+ * Set to non-zero to speak MQTT 5 instead of MQTT 3.1.1. Only the part of
+ * MQTT 5 needed for topic aliases is implemented, other properties are
+ * neither sent nor used.
+ */
+#ifndef UMQTT_PROTOCOL_V5
+#define UMQTT_PROTOCOL_V5   0
+#endif
+
+/** Protocol level field of MQTT CONNECT message. */
+#if UMQTT_PROTOCOL_V5
+#define UMQTT_CONNECT_PROTOCOL_LEVEL        0x05
+#else
 #define UMQTT_CONNECT_PROTOCOL_LEVEL        0x04
+#endif
+
+/**
+ * MQTT 5 session expiry interval in seconds for UMQTT_OPT_PERSISTENT. MQTT 3.1.1
+ * session lasts until broker drops it.
+ */
+#ifndef UMQTT_SESSION_EXPIRY
+#define UMQTT_SESSION_EXPIRY                3600
+#endif
+
+/** Highest topic alias this client can assign. */
+#define UMQTT_TOPIC_ALIAS_MAX               8
+
+/**
+ * MQTT 5 property identifiers.
+ */
+#define UMQTT_PROPERTY_SUBSCRIPTION_ID      0x0b
+#define UMQTT_PROPERTY_SESSION_EXPIRY       0x11
+#define UMQTT_PROPERTY_TOPIC_ALIAS_MAXIMUM  0x22
+#define UMQTT_PROPERTY_TOPIC_ALIAS          0x23
 
 /**
  * Connection bit flags.
@@ -42,12 +102,16 @@
 
 /** UMQTT flags */
 #define UMQTT_OPT_RETAIN                    0
+#define UMQTT_OPT_DUP                       1
+/** Connect without clean session, broker keeps session over reconnect. */
+#define UMQTT_OPT_PERSISTENT                2
 
 /** Type of MQTT packets. */
 enum umqtt_packet_type {
     UMQTT_CONNECT       = 1,        /**< CONNECT */
     UMQTT_CONNACK       = 2,        /**< CONNACK */
     UMQTT_PUBLISH       = 3,        /**< PUBLISH */
+    UMQTT_PUBACK        = 4,        /**< PUBACK */
     UMQTT_SUBSCRIBE     = 8,        /**< SUBSCRIBE */
     UMQTT_SUBACK        = 9,        /**< SUBACK */
     UMQTT_UNSUBSCRIBE   = 10,       /**< UNSUBSCRIBE */
@@ -66,6 +130,32 @@ enum umqtt_qos {
     UMQTT_QOS_2 = 2,        /**< Exactly once delivery. */
 };
 
+/** Size of buffer for fixed length fields of incoming packets. */
+#define UMQTT_RX_WORK_SIZE                  4
+
+/** State of incoming packet parser. */
+enum umqtt_rx_state {
+    UMQTT_RX_HEADER,        /**< Waiting for fixed header. */
+    UMQTT_RX_LENGTH,        /**< Decoding remaining length. */
+    UMQTT_RX_TOPIC_LEN,     /**< Reading PUBLISH topic length. */
+    UMQTT_RX_TOPIC,         /**< Streaming PUBLISH topic. */
+    UMQTT_RX_MESSAGE_ID,    /**< Reading PUBLISH message id. */
+    UMQTT_RX_PAYLOAD,       /**< Streaming PUBLISH payload. */
+    UMQTT_RX_BODY,          /**< Reading body of other packets. */
+#if UMQTT_PROTOCOL_V5
+    UMQTT_RX_CONNACK,       /**< Reading CONNACK flags and reason code. */
+    UMQTT_RX_PROPERTIES_LEN,/**< Decoding properties length. */
+    UMQTT_RX_PROPERTIES,    /**< Scanning properties. */
+#endif
+};
+
+/** Part of incoming PUBLISH message passed to message callback. */
+enum umqtt_message_part {
+    UMQTT_MESSAGE_TOPIC,    /**< Chunk of topic name. */
+    UMQTT_MESSAGE_PAYLOAD,  /**< Chunk of payload. */
+    UMQTT_MESSAGE_END,      /**< Message is complete. No data. */
+};
+
 /** State of MQTT client. */
 enum umqtt_client_state {
     UMQTT_STATE_INIT,
@@ -84,23 +174,80 @@ struct umqtt_circ_buffer {
     int16_t datalen;
 };
 
+/**
+ * Topic name with precomputed length, stored in program memory. Length prefix
+ * is already encoded, so that topic field is copied to TX buffer as is.
+ * Define it with UMQTT_TOPIC_INIT().
+ */
+struct umqtt_topic {
+    uint8_t alias;          /**< MQTT 5 topic alias, 1 to UMQTT_TOPIC_ALIAS_MAX, or 0. */
+    uint8_t length[2];      /**< Big endian topic length. */
+    char name[];            /**< Topic name, not null terminated on the wire. */
+};
+
+/**
+ * Initializer of struct umqtt_topic.
+ *
+ * @param topic String literal with topic name.
+ * @param alias Topic alias, unique within connection. Ignored with MQTT 3.1.1.
+ */
+#define UMQTT_TOPIC_INIT(topic, alias) \
+    { (alias), { (sizeof(topic) - 1) >> 8, (sizeof(topic) - 1) & 0xff }, topic }
+
 /** MQTT connection object. */
 struct umqtt_connection {
     struct umqtt_circ_buffer txbuff;        /**< TX buffer. */
     struct umqtt_circ_buffer rxbuff;        /**< RX buffer. */
 
-    /** Pointer to message handler function. */
-    void (*message_callback)(struct umqtt_connection *, char *topic, uint8_t *data, uint16_t len);
+    /**
+     * Pointer to message handler function. Incoming PUBLISH is delivered in
+     * chunks as it arrives: topic chunks, payload chunks and end mark.
+     * Topic is not null terminated.
+     */
+    void (*message_callback)(struct umqtt_connection *, enum umqtt_message_part part, uint8_t *data, uint16_t len);
+
+    /** Pointer to PUBACK handler function or NULL. */
+    void (*puback_callback)(struct umqtt_connection *, uint16_t message_id);
 
     /* Private */
     /* ack counters - incremented on sending, decremented on ack */
     int16_t nack_publish;
     int16_t nack_subscribe;
     int16_t nack_ping;
-    int16_t message_id;
-    uint8_t work_buf[5];
-    int16_t work_read;
+    uint16_t message_id;
     enum umqtt_client_state state;
+    bool session_present;                   /**< Broker kept session, from CONNACK. */
+
+    /* Incoming packet parser */
+    enum umqtt_rx_state rx_state;
+    uint8_t rx_header;                      /**< Fixed header of current packet. */
+    uint32_t rx_remaining;                  /**< Bytes of current packet not read yet. */
+    uint16_t rx_field;                      /**< Bytes of current topic or properties not read yet. */
+    uint8_t rx_work[UMQTT_RX_WORK_SIZE];    /**< Fixed length fields. */
+    uint8_t rx_work_len;
+
+#if UMQTT_PROTOCOL_V5
+    uint16_t topic_alias_max;               /**< Topic Alias Maximum from CONNACK. */
+    uint8_t alias_known;                    /**< Aliases broker knows, bit n - 1 for alias n. */
+    uint8_t alias_sent;                     /**< Aliases set up by data not acknowledged yet. */
+
+    /* MQTT 5 property scanner */
+    uint8_t rx_prop;                        /**< Current property id, 0 when id is expected. */
+    uint8_t rx_prop_strings;                /**< Strings of current property not read yet. */
+    bool rx_prop_skip;                      /**< Skipping string data. */
+    uint16_t rx_prop_left;                  /**< Bytes of current value not read yet. */
+    uint32_t rx_value;                      /**< Value being read. */
+#endif
+};
+
+/** Position in TX buffer, for dropping packets encoded after it. */
+struct umqtt_tx_mark {
+    int16_t datalen;
+    int16_t nack_publish;
+    int16_t nack_ping;
+#if UMQTT_PROTOCOL_V5
+    uint8_t alias_sent;
+#endif
 };
 
 /** Configuration object for connecting to MQTT broker. */
@@ -139,16 +286,37 @@ void umqtt_init(struct umqtt_connection *conn);
  *
  * @param conn Connection object.
  * @param config Connection config object.
+ * @return True if packet was queued, false if it doesn't fit into TX buffer.
  */
-void umqtt_connect(struct umqtt_connection *conn, struct umqtt_connect_config *config);
+bool umqtt_connect(struct umqtt_connection *conn, struct umqtt_connect_config *config);
+
+/**
+ * Connect to MQTT broker. Config object, client id, will topic and will
+ * message are all in program memory and are copied straight to TX buffer.
+ *
+ * @param conn Connection object.
+ * @param config Connection config object in program memory.
+ * @return True if packet was queued, false if it doesn't fit into TX buffer.
+ */
+bool umqtt_connect_P(struct umqtt_connection *conn, const struct umqtt_connect_config *config);
 
 /**
  * Subscribe to MQTT topic.
  *
  * @param conn Connection object.
  * @param topic Topic name.
+ * @return True if packet was queued, false if it doesn't fit into TX buffer.
+ */
+bool umqtt_subscribe(struct umqtt_connection *conn, char *topic);
+
+/**
+ * Subscribe to MQTT topic stored in program memory.
+ *
+ * @param conn Connection object.
+ * @param topic Topic name in program memory.
+ * @return True if packet was queued, false if it doesn't fit into TX buffer.
  */
-void umqtt_subscribe(struct umqtt_connection *conn, char *topic);
+bool umqtt_subscribe_P(struct umqtt_connection *conn, const char *topic);
 
 /**
  * Publish MQTT message.
@@ -157,18 +325,94 @@ void umqtt_subscribe(struct umqtt_connection *conn, char *topic);
  * @param topic Message topic.
  * @param data Message payload.
  * @param datalen Message payload length.
+ * @return True if packet was queued, false if it doesn't fit into TX buffer.
+ */
+bool umqtt_publish(struct umqtt_connection *conn, char *topic, uint8_t *data, uint16_t datalen, uint8_t flags);
+
+/**
+ * Publish MQTT message with topic and payload stored in program memory.
+ *
+ * @param conn Connection object.
+ * @param topic Message topic in program memory.
+ * @param data Message payload in program memory.
+ * @param datalen Message payload length.
+ * @param flags UMQTT_OPT_RETAIN flag.
+ * @return True if packet was queued, false if it doesn't fit into TX buffer.
+ */
+bool umqtt_publish_P(struct umqtt_connection *conn, const char *topic, const uint8_t *data, uint16_t datalen, uint8_t flags);
+
+/**
+ * Publish MQTT message to topic from program memory. Topic is copied without
+ * strlen(). With MQTT 5 and topic alias allowed by broker, topic name is sent
+ * only once over connection, later messages carry just the alias. With QoS 1
+ * broker acknowledges message with PUBACK carrying the same message id.
+ * Message which was already sent in kept session should be sent again with
+ * UMQTT_OPT_DUP flag.
+ *
+ * @param conn Connection object.
+ * @param topic Message topic in program memory.
+ * @param data Message payload.
+ * @param datalen Message payload length.
+ * @param flags UMQTT_OPT_RETAIN and UMQTT_OPT_DUP flags.
+ * @param message_id Id obtained from umqtt_message_id() for QoS 1, zero for QoS 0.
+ * @return True if packet was queued, false if it doesn't fit into TX buffer.
+ */
+bool umqtt_publish_topic(struct umqtt_connection *conn, const struct umqtt_topic *topic, uint8_t *data, uint16_t datalen, uint8_t flags, uint16_t message_id);
+
+/**
+ * Remember current end of TX buffer.
+ *
+ * @param conn Connection object.
+ * @param mark Mark to fill.
+ */
+void umqtt_tx_mark(struct umqtt_connection *conn, struct umqtt_tx_mark *mark);
+
+/**
+ * Drop packets queued after mark was taken.
+ *
+ * @param conn Connection object.
+ * @param mark Mark filled by umqtt_tx_mark().
+ */
+void umqtt_tx_rollback(struct umqtt_connection *conn, struct umqtt_tx_mark *mark);
+
+/**
+ * Packets queued after mark was taken repeat ones which were already sent,
+ * e.g. TCP retransmission. They already wait for acknowledgement, so they are
+ * not counted again.
+ *
+ * @param conn Connection object.
+ * @param mark Mark filled by umqtt_tx_mark().
+ */
+void umqtt_tx_repeated(struct umqtt_connection *conn, struct umqtt_tx_mark *mark);
+
+/**
+ * Notify that content of TX buffer was delivered to broker. Topic aliases
+ * set up by it can be used from now on. Until then, retransmission encodes
+ * the same bytes.
+ *
+ * @param conn Connection object.
+ */
+void umqtt_tx_acked(struct umqtt_connection *conn);
+
+/**
+ * Allocate message id for packet which needs acknowledgement.
+ *
+ * @param conn Connection object.
+ * @return Non-zero message id.
  */
-void umqtt_publish(struct umqtt_connection *conn, char *topic, uint8_t *data, uint16_t datalen, uint8_t flags);
+uint16_t umqtt_message_id(struct umqtt_connection *conn);
 
 /**
  * Send PINGREQ message to MQTT broker.
  *
  * @param conn Connection object.
+ * @return True if packet was queued, false if it doesn't fit into TX buffer.
  */
-void umqtt_ping(struct umqtt_connection *conn);
+bool umqtt_ping(struct umqtt_connection *conn);
 
 /**
- * Process RX buffer.
+ * Process RX buffer. Incomplete packets are parsed as far as possible and
+ * parsing continues when more data is pushed into RX buffer.
  *
  * @param conn Connection object.
  */